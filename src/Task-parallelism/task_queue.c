@@ -52,7 +52,9 @@ Task pop(task_queue *tq) {
     if (tq->head->next) {
         tq->head = temp->next;
     } else {
+        // The queue is empty now, so a task loaded by the task being run becomes the head
         tq->head = NULL;
+        tq->tail = NULL;
     }
     tq->size--;
     free(temp);
@@ -6,8 +6,9 @@
  * Hence MPI initialisation is included in the initialisation function
  */
 void initialize_worker(worker *man, MPI_Comm comm, void* initialize_function, int argc, char *argv[]){
-    // Initialise MPI
-    MPI_Init(&argc, &argv);
+    // Initialise MPI, only the main thread of a process calls MPI while the OpenMP threads compute
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
     MPI_Comm_size(comm, &man->population);
     MPI_Comm_rank(comm, &man->id);
     man->loop_index = 0;
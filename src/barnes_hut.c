@@ -0,0 +1,196 @@
+#include "barnes_hut.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static int build_node(struct barnes_hut_tree *, int, int, double, double, double, double, int);
+
+static int new_node(struct barnes_hut_tree *);
+
+static int octant(struct gravity_sources *, int, double, double, double);
+
+/*
+ * Allocate a tree for up to capacity sources with at most leaf_size bodies per leaf, nodes are allocated on demand
+ */
+void allocate_barnes_hut_tree(struct barnes_hut_tree *tree, int capacity, int leaf_size) {
+    tree->leaf_size = leaf_size;
+    tree->node_count = 0;
+    tree->node_capacity = capacity / leaf_size * 2 + 64;
+    tree->nodes = (struct barnes_hut_node *) malloc(sizeof(struct barnes_hut_node) * tree->node_capacity);
+    allocate_gravity_sources(&tree->sorted, capacity);
+    allocate_gravity_sources(&tree->scratch, capacity);
+}
+
+/*
+ * Build the octree over the sources
+ * The root is the smallest cube that contains every source, cubes with more than leaf_size bodies are
+ * split into octants, and the mass and centre of mass of every cube are summed up from its octants
+ */
+void build_barnes_hut_tree(struct barnes_hut_tree *tree, struct gravity_sources *sources) {
+    int count = sources->count;
+    tree->node_count = 0;
+    tree->sorted.count = count;
+    if (count == 0) return;
+    memcpy(tree->sorted.index, sources->index, sizeof(int) * count);
+    memcpy(tree->sorted.x, sources->x, sizeof(double) * count);
+    memcpy(tree->sorted.y, sources->y, sizeof(double) * count);
+    memcpy(tree->sorted.z, sources->z, sizeof(double) * count);
+    memcpy(tree->sorted.mass, sources->mass, sizeof(double) * count);
+
+    double min_x = sources->x[0], max_x = sources->x[0];
+    double min_y = sources->y[0], max_y = sources->y[0];
+    double min_z = sources->z[0], max_z = sources->z[0];
+    for (int i = 1; i < count; i++) {
+        min_x = fmin(min_x, sources->x[i]);
+        max_x = fmax(max_x, sources->x[i]);
+        min_y = fmin(min_y, sources->y[i]);
+        max_y = fmax(max_y, sources->y[i]);
+        min_z = fmin(min_z, sources->z[i]);
+        max_z = fmax(max_z, sources->z[i]);
+    }
+    double half_size = fmax(max_x - min_x, fmax(max_y - min_y, max_z - min_z)) / 2;
+    // Grow the cube slightly so that no body sits exactly on its boundary
+    half_size = half_size * (1 + 1e-9) + 1;
+    build_node(tree, 0, count, (min_x + max_x) / 2, (min_y + max_y) / 2, (min_z + max_z) / 2, half_size, 0);
+}
+
+/*
+ * Sums the acceleration (without the gravitational constant) on a point by walking the tree
+ * A cube is replaced by its total mass at its centre of mass if the point is further than size / theta away from the
+ * centre of mass, plus the distance between the centre of mass and the centre of the cube so the point is never inside
+ * an accepted cube. Leaves that have to be opened are summed body by body with the vectorised kernel
+ */
+void barnes_hut_acceleration(struct barnes_hut_tree *tree, double x, double y, double z, double theta,
+                             double *acceleration) {
+    int stack[8 * BARNES_HUT_MAX_DEPTH + 8];
+    int top = 0;
+    double ax = 0, ay = 0, az = 0;
+
+    if (tree->node_count > 0) stack[top++] = 0;
+    while (top > 0) {
+        struct barnes_hut_node *node = &tree->nodes[stack[--top]];
+        if (node->leaf) {
+            accumulate_acceleration(x, y, z, &tree->sorted, node->first, node->last, acceleration);
+            continue;
+        }
+        double dx = node->mass_x - x;
+        double dy = node->mass_y - y;
+        double dz = node->mass_z - z;
+        double r2 = dx * dx + dy * dy + dz * dz;
+        double offset_x = node->mass_x - node->centre_x;
+        double offset_y = node->mass_y - node->centre_y;
+        double offset_z = node->mass_z - node->centre_z;
+        double offset = sqrt(offset_x * offset_x + offset_y * offset_y + offset_z * offset_z);
+        double opening_distance = 2 * node->half_size / theta + offset;
+        if (r2 > opening_distance * opening_distance) {
+            double tmp = node->mass / (r2 * sqrt(r2));
+            ax += tmp * dx;
+            ay += tmp * dy;
+            az += tmp * dz;
+        } else {
+            for (int k = 0; k < 8; k++) {
+                if (node->children[k] >= 0) stack[top++] = node->children[k];
+            }
+        }
+    }
+    acceleration[0] += ax;
+    acceleration[1] += ay;
+    acceleration[2] += az;
+}
+
+/*
+ * Build the node for the cube with the given centre and half size that holds sorted bodies [first, last)
+ * Returns the index of the node, nodes may be reallocated so they are always accessed through their index
+ */
+static int build_node(struct barnes_hut_tree *tree, int first, int last, double centre_x, double centre_y,
+                      double centre_z, double half_size, int depth) {
+    int id = new_node(tree);
+    struct barnes_hut_node *node = &tree->nodes[id];
+    node->centre_x = centre_x;
+    node->centre_y = centre_y;
+    node->centre_z = centre_z;
+    node->half_size = half_size;
+    node->first = first;
+    node->last = last;
+    node->leaf = last - first <= tree->leaf_size || depth >= BARNES_HUT_MAX_DEPTH;
+    for (int k = 0; k < 8; k++) node->children[k] = -1;
+
+    double mass = 0, mass_x = 0, mass_y = 0, mass_z = 0;
+    if (node->leaf) {
+        for (int i = first; i < last; i++) {
+            mass += tree->sorted.mass[i];
+            mass_x += tree->sorted.mass[i] * tree->sorted.x[i];
+            mass_y += tree->sorted.mass[i] * tree->sorted.y[i];
+            mass_z += tree->sorted.mass[i] * tree->sorted.z[i];
+        }
+    } else {
+        // Counting sort of the bodies by octant, through the scratch buffer
+        int counts[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+        int offsets[8];
+        for (int i = first; i < last; i++) counts[octant(&tree->sorted, i, centre_x, centre_y, centre_z)]++;
+        offsets[0] = first;
+        for (int k = 1; k < 8; k++) offsets[k] = offsets[k - 1] + counts[k - 1];
+        for (int i = first; i < last; i++) {
+            int target = offsets[octant(&tree->sorted, i, centre_x, centre_y, centre_z)]++;
+            tree->scratch.index[target] = tree->sorted.index[i];
+            tree->scratch.x[target] = tree->sorted.x[i];
+            tree->scratch.y[target] = tree->sorted.y[i];
+            tree->scratch.z[target] = tree->sorted.z[i];
+            tree->scratch.mass[target] = tree->sorted.mass[i];
+        }
+        int range = last - first;
+        memcpy(&tree->sorted.index[first], &tree->scratch.index[first], sizeof(int) * range);
+        memcpy(&tree->sorted.x[first], &tree->scratch.x[first], sizeof(double) * range);
+        memcpy(&tree->sorted.y[first], &tree->scratch.y[first], sizeof(double) * range);
+        memcpy(&tree->sorted.z[first], &tree->scratch.z[first], sizeof(double) * range);
+        memcpy(&tree->sorted.mass[first], &tree->scratch.mass[first], sizeof(double) * range);
+
+        double quarter = half_size / 2;
+        int child_first = first;
+        for (int k = 0; k < 8; k++) {
+            if (counts[k] == 0) continue;
+            int child = build_node(tree, child_first, child_first + counts[k],
+                                   centre_x + (k & 1 ? quarter : -quarter),
+                                   centre_y + (k & 2 ? quarter : -quarter),
+                                   centre_z + (k & 4 ? quarter : -quarter), quarter, depth + 1);
+            tree->nodes[id].children[k] = child;
+            mass += tree->nodes[child].mass;
+            mass_x += tree->nodes[child].mass * tree->nodes[child].mass_x;
+            mass_y += tree->nodes[child].mass * tree->nodes[child].mass_y;
+            mass_z += tree->nodes[child].mass * tree->nodes[child].mass_z;
+            child_first += counts[k];
+        }
+    }
+
+    node = &tree->nodes[id];
+    node->mass = mass;
+    if (mass > 0) {
+        node->mass_x = mass_x / mass;
+        node->mass_y = mass_y / mass;
+        node->mass_z = mass_z / mass;
+    } else {
+        node->mass_x = centre_x;
+        node->mass_y = centre_y;
+        node->mass_z = centre_z;
+    }
+    return id;
+}
+
+/*
+ * Take the next free node, doubling the node pool when it is full
+ */
+static int new_node(struct barnes_hut_tree *tree) {
+    if (tree->node_count == tree->node_capacity) {
+        tree->node_capacity *= 2;
+        tree->nodes = (struct barnes_hut_node *) realloc(tree->nodes,
+                                                         sizeof(struct barnes_hut_node) * tree->node_capacity);
+    }
+    return tree->node_count++;
+}
+
+/*
+ * Octant of sorted body i in a cube centred at the given point, bit 0 for x, bit 1 for y and bit 2 for z
+ */
+static int octant(struct gravity_sources *sources, int i, double centre_x, double centre_y, double centre_z) {
+    return (sources->x[i] >= centre_x) | (sources->y[i] >= centre_y) << 1 | (sources->z[i] >= centre_z) << 2;
+}
@@ -0,0 +1,43 @@
+#ifndef BARNES_HUT_INCLUDE
+#define BARNES_HUT_INCLUDE
+
+#include <stdbool.h>
+#include "gravity_kernel.h"
+
+// Maximum number of bodies kept in a leaf of the octree, unless the tree is allocated with another leaf size
+#define BARNES_HUT_LEAF_SIZE 8
+
+// Maximum depth of the octree, bodies that are still together at this depth share a leaf
+#define BARNES_HUT_MAX_DEPTH 48
+
+/*
+ * A cube of the octree
+ * The bodies inside a node are a contiguous range of the sorted sources of the tree
+ */
+struct barnes_hut_node {
+    double centre_x, centre_y, centre_z, half_size;
+    double mass; // total mass of the bodies in the cube
+    double mass_x, mass_y, mass_z; // centre of mass of the bodies in the cube
+    int first, last; // range of the bodies of the cube in the sorted sources
+    int children[8]; // index of the node of each octant, -1 if the octant is empty
+    bool leaf;
+};
+
+/*
+ * Octree over the gravity sources, rebuilt every timestep
+ */
+struct barnes_hut_tree {
+    int leaf_size; // maximum number of bodies kept in a leaf
+    int node_count, node_capacity;
+    struct barnes_hut_node *nodes;
+    struct gravity_sources sorted; // sources reordered so that every node covers a contiguous range
+    struct gravity_sources scratch; // buffer used while reordering
+};
+
+void allocate_barnes_hut_tree(struct barnes_hut_tree *, int, int);
+
+void build_barnes_hut_tree(struct barnes_hut_tree *, struct gravity_sources *);
+
+void barnes_hut_acceleration(struct barnes_hut_tree *, double, double, double, double, double *);
+
+#endif
@@ -0,0 +1,77 @@
+#include "collision_schedule.h"
+#include <stdlib.h>
+#include <stdbool.h>
+#include <math.h>
+
+static void swap_entries(struct collision_schedule *, int, int);
+
+/*
+ * Allocate a schedule for capacity pairs, it grows when more are scheduled
+ */
+void allocate_collision_schedule(struct collision_schedule *schedule, int capacity) {
+    schedule->count = 0;
+    schedule->capacity = capacity;
+    schedule->time = (double *) malloc(sizeof(double) * capacity);
+    schedule->pair = (long int *) malloc(sizeof(long int) * capacity);
+}
+
+/*
+ * Drop every scheduled pair
+ */
+void clear_collision_schedule(struct collision_schedule *schedule) {
+    schedule->count = 0;
+}
+
+/*
+ * Add a pair that can not touch before the given time
+ */
+void schedule_pair(struct collision_schedule *schedule, double time, long int pair) {
+    if (schedule->count == schedule->capacity) {
+        schedule->capacity *= 2;
+        schedule->time = (double *) realloc(schedule->time, sizeof(double) * schedule->capacity);
+        schedule->pair = (long int *) realloc(schedule->pair, sizeof(long int) * schedule->capacity);
+    }
+    int k = schedule->count++;
+    schedule->time[k] = time;
+    schedule->pair[k] = pair;
+    while (k > 0 && schedule->time[(k - 1) / 2] > schedule->time[k]) {
+        swap_entries(schedule, k, (k - 1) / 2);
+        k = (k - 1) / 2;
+    }
+}
+
+/*
+ * Earliest time of the scheduled pairs, infinity if there are none
+ */
+double next_scheduled_time(struct collision_schedule *schedule) {
+    return schedule->count > 0 ? schedule->time[0] : HUGE_VAL;
+}
+
+/*
+ * Remove the pair with the earliest time and return it
+ */
+long int pop_scheduled_pair(struct collision_schedule *schedule) {
+    long int pair = schedule->pair[0];
+    schedule->count--;
+    schedule->time[0] = schedule->time[schedule->count];
+    schedule->pair[0] = schedule->pair[schedule->count];
+    int k = 0;
+    while (true) {
+        int smallest = k, left = 2 * k + 1, right = 2 * k + 2;
+        if (left < schedule->count && schedule->time[left] < schedule->time[smallest]) smallest = left;
+        if (right < schedule->count && schedule->time[right] < schedule->time[smallest]) smallest = right;
+        if (smallest == k) break;
+        swap_entries(schedule, k, smallest);
+        k = smallest;
+    }
+    return pair;
+}
+
+static void swap_entries(struct collision_schedule *schedule, int a, int b) {
+    double time = schedule->time[a];
+    long int pair = schedule->pair[a];
+    schedule->time[a] = schedule->time[b];
+    schedule->pair[a] = schedule->pair[b];
+    schedule->time[b] = time;
+    schedule->pair[b] = pair;
+}
@@ -0,0 +1,24 @@
+#ifndef COLLISION_SCHEDULE_INCLUDE
+#define COLLISION_SCHEDULE_INCLUDE
+
+/*
+ * Min-heap of pairs of bodies keyed by the earliest model time at which they could touch
+ * A pair is only checked again for a collision once its time has come
+ */
+struct collision_schedule {
+    int count, capacity;
+    double *time;
+    long int *pair; // pair code i * max_body_size + j
+};
+
+void allocate_collision_schedule(struct collision_schedule *, int);
+
+void clear_collision_schedule(struct collision_schedule *);
+
+void schedule_pair(struct collision_schedule *, double, long int);
+
+double next_scheduled_time(struct collision_schedule *);
+
+long int pop_scheduled_pair(struct collision_schedule *);
+
+#endif
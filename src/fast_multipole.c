@@ -0,0 +1,391 @@
+#include "fast_multipole.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static void upward_pass(struct fast_multipole *, struct barnes_hut_tree *);
+
+static void dual_tree_walk(struct fast_multipole *, struct barnes_hut_tree *, double);
+
+static void downward_pass(struct fast_multipole *, struct barnes_hut_tree *);
+
+static void push_pair(struct fast_multipole *, int *, int, int);
+
+static void multipole_to_local(struct fast_multipole *, struct barnes_hut_tree *, int, int);
+
+static void particle_to_particle(struct fast_multipole *, struct barnes_hut_tree *, int, int);
+
+static void powers(struct fast_multipole *, double, double, double, double *);
+
+static void taylor_coefficients(struct fast_multipole *, double, double, double, double *);
+
+static double binomial(int, int);
+
+static int term(struct fast_multipole *, int, int, int);
+
+/*
+ * Allocate the solver for the given expansion order and up to capacity bodies, and build the translation tables
+ */
+void allocate_fast_multipole(struct fast_multipole *fmm, int order, int capacity) {
+    if (order < 1) order = 1;
+    if (order > FAST_MULTIPOLE_MAX_ORDER) order = FAST_MULTIPOLE_MAX_ORDER;
+    fmm->order = order;
+    fmm->terms = (order + 1) * (order + 2) * (order + 3) / 6;
+    fmm->exponents = (int *) malloc(sizeof(int) * 3 * fmm->terms);
+    fmm->index_of = (int *) malloc(sizeof(int) * (order + 1) * (order + 1) * (order + 1));
+    for (int i = 0; i < (order + 1) * (order + 1) * (order + 1); i++) fmm->index_of[i] = -1;
+
+    // Enumerate the multi-indices by degree, so that lower degrees always come first
+    int t = 0;
+    for (int degree = 0; degree <= order; degree++) {
+        for (int a = degree; a >= 0; a--) {
+            for (int b = degree - a; b >= 0; b--) {
+                int c = degree - a - b;
+                fmm->exponents[3 * t] = a;
+                fmm->exponents[3 * t + 1] = b;
+                fmm->exponents[3 * t + 2] = c;
+                fmm->index_of[(a * (order + 1) + b) * (order + 1) + c] = t++;
+            }
+        }
+    }
+
+    fmm->lower = (int *) malloc(sizeof(int) * 3 * fmm->terms);
+    fmm->lower_twice = (int *) malloc(sizeof(int) * 3 * fmm->terms);
+    for (t = 0; t < fmm->terms; t++) {
+        for (int i = 0; i < 3; i++) {
+            int e[3] = {fmm->exponents[3 * t], fmm->exponents[3 * t + 1], fmm->exponents[3 * t + 2]};
+            e[i]--;
+            fmm->lower[3 * t + i] = e[i] >= 0 ? term(fmm, e[0], e[1], e[2]) : -1;
+            e[i]--;
+            fmm->lower_twice[3 * t + i] = e[i] >= 0 ? term(fmm, e[0], e[1], e[2]) : -1;
+        }
+    }
+
+    // Shift table, every pair of multi-indices m <= n
+    fmm->shift_count = 0;
+    for (int n = 0; n < fmm->terms; n++) {
+        for (int m = 0; m < fmm->terms; m++) {
+            int *en = &fmm->exponents[3 * n], *em = &fmm->exponents[3 * m];
+            if (em[0] <= en[0] && em[1] <= en[1] && em[2] <= en[2]) fmm->shift_count++;
+        }
+    }
+    fmm->shift_big = (int *) malloc(sizeof(int) * fmm->shift_count);
+    fmm->shift_small = (int *) malloc(sizeof(int) * fmm->shift_count);
+    fmm->shift_power = (int *) malloc(sizeof(int) * fmm->shift_count);
+    fmm->shift_coefficient = (double *) malloc(sizeof(double) * fmm->shift_count);
+    t = 0;
+    for (int n = 0; n < fmm->terms; n++) {
+        for (int m = 0; m < fmm->terms; m++) {
+            int *en = &fmm->exponents[3 * n], *em = &fmm->exponents[3 * m];
+            if (em[0] <= en[0] && em[1] <= en[1] && em[2] <= en[2]) {
+                fmm->shift_big[t] = n;
+                fmm->shift_small[t] = m;
+                fmm->shift_power[t] = term(fmm, en[0] - em[0], en[1] - em[1], en[2] - em[2]);
+                fmm->shift_coefficient[t++] = binomial(en[0], em[0]) * binomial(en[1], em[1]) *
+                                              binomial(en[2], em[2]);
+            }
+        }
+    }
+
+    // Conversion table, L_k += C(k + n, k) * (-1)^|n| * T_(k + n) * M_n for |k| + |n| <= order
+    fmm->convert_count = 0;
+    for (int k = 0; k < fmm->terms; k++) {
+        for (int n = 0; n < fmm->terms; n++) {
+            int *ek = &fmm->exponents[3 * k], *en = &fmm->exponents[3 * n];
+            if (ek[0] + ek[1] + ek[2] + en[0] + en[1] + en[2] <= order) fmm->convert_count++;
+        }
+    }
+    fmm->convert_local = (int *) malloc(sizeof(int) * fmm->convert_count);
+    fmm->convert_multipole = (int *) malloc(sizeof(int) * fmm->convert_count);
+    fmm->convert_taylor = (int *) malloc(sizeof(int) * fmm->convert_count);
+    fmm->convert_coefficient = (double *) malloc(sizeof(double) * fmm->convert_count);
+    t = 0;
+    for (int k = 0; k < fmm->terms; k++) {
+        for (int n = 0; n < fmm->terms; n++) {
+            int *ek = &fmm->exponents[3 * k], *en = &fmm->exponents[3 * n];
+            int degree = en[0] + en[1] + en[2];
+            if (ek[0] + ek[1] + ek[2] + degree <= order) {
+                fmm->convert_local[t] = k;
+                fmm->convert_multipole[t] = n;
+                fmm->convert_taylor[t] = term(fmm, ek[0] + en[0], ek[1] + en[1], ek[2] + en[2]);
+                fmm->convert_coefficient[t++] = (degree % 2 == 0 ? 1 : -1) * binomial(ek[0] + en[0], ek[0]) *
+                                                binomial(ek[1] + en[1], ek[1]) * binomial(ek[2] + en[2], ek[2]);
+            }
+        }
+    }
+
+    fmm->node_capacity = 0;
+    fmm->multipoles = NULL;
+    fmm->locals = NULL;
+    fmm->radius = NULL;
+    fmm->targets = NULL;
+    fmm->pair_capacity = 1024;
+    fmm->pairs = (int *) malloc(sizeof(int) * 2 * fmm->pair_capacity);
+    fmm->target = (bool *) malloc(sizeof(bool) * capacity);
+    fmm->acceleration_x = (double *) malloc(sizeof(double) * capacity);
+    fmm->acceleration_y = (double *) malloc(sizeof(double) * capacity);
+    fmm->acceleration_z = (double *) malloc(sizeof(double) * capacity);
+}
+
+/*
+ * Computes the acceleration (without the gravitational constant) of the bodies of the tree with an index in the body
+ * store in [first_target, last_target), results are in fmm->acceleration_x/y/z in the order of tree->sorted
+ * Every process holds the whole tree, so the expansions are built everywhere but the walk skips every node that has
+ * none of the targets of this process
+ * Two nodes interact through their expansions if (r_a + r_b) < theta * distance, where r is the radius of a node
+ */
+void fast_multipole_accelerations(struct fast_multipole *fmm, struct barnes_hut_tree *tree, double theta,
+                                  int first_target, int last_target) {
+    if (tree->node_count > fmm->node_capacity) {
+        fmm->node_capacity = tree->node_count * 2;
+        fmm->multipoles = (double *) realloc(fmm->multipoles, sizeof(double) * fmm->terms * fmm->node_capacity);
+        fmm->locals = (double *) realloc(fmm->locals, sizeof(double) * fmm->terms * fmm->node_capacity);
+        fmm->radius = (double *) realloc(fmm->radius, sizeof(double) * fmm->node_capacity);
+        fmm->targets = (int *) realloc(fmm->targets, sizeof(int) * fmm->node_capacity);
+    }
+    for (int i = 0; i < tree->sorted.count; i++) {
+        fmm->target[i] = tree->sorted.index[i] >= first_target && tree->sorted.index[i] < last_target;
+        fmm->acceleration_x[i] = 0;
+        fmm->acceleration_y[i] = 0;
+        fmm->acceleration_z[i] = 0;
+    }
+    if (tree->node_count == 0) return;
+    memset(fmm->locals, 0, sizeof(double) * fmm->terms * tree->node_count);
+
+    upward_pass(fmm, tree);
+    dual_tree_walk(fmm, tree, theta);
+    downward_pass(fmm, tree);
+}
+
+/*
+ * Multipole expansions, radii and target counts of every node, from the leaves up
+ * Nodes are created before their octants, so walking them backwards visits octants first
+ */
+static void upward_pass(struct fast_multipole *fmm, struct barnes_hut_tree *tree) {
+    double power[fmm->terms];
+    for (int id = tree->node_count - 1; id >= 0; id--) {
+        struct barnes_hut_node *node = &tree->nodes[id];
+        double *multipole = &fmm->multipoles[fmm->terms * id];
+        memset(multipole, 0, sizeof(double) * fmm->terms);
+        fmm->radius[id] = 0;
+        fmm->targets[id] = 0;
+        if (node->leaf) {
+            for (int i = node->first; i < node->last; i++) {
+                double dx = tree->sorted.x[i] - node->mass_x;
+                double dy = tree->sorted.y[i] - node->mass_y;
+                double dz = tree->sorted.z[i] - node->mass_z;
+                powers(fmm, dx, dy, dz, power);
+                for (int n = 0; n < fmm->terms; n++) multipole[n] += tree->sorted.mass[i] * power[n];
+                fmm->radius[id] = fmax(fmm->radius[id], sqrt(dx * dx + dy * dy + dz * dz));
+                if (fmm->target[i]) fmm->targets[id]++;
+            }
+        } else {
+            for (int k = 0; k < 8; k++) {
+                int child = node->children[k];
+                if (child < 0) continue;
+                double dx = tree->nodes[child].mass_x - node->mass_x;
+                double dy = tree->nodes[child].mass_y - node->mass_y;
+                double dz = tree->nodes[child].mass_z - node->mass_z;
+                powers(fmm, dx, dy, dz, power);
+                double *child_multipole = &fmm->multipoles[fmm->terms * child];
+                for (int s = 0; s < fmm->shift_count; s++) {
+                    multipole[fmm->shift_big[s]] += fmm->shift_coefficient[s] * power[fmm->shift_power[s]] *
+                                                    child_multipole[fmm->shift_small[s]];
+                }
+                fmm->radius[id] = fmax(fmm->radius[id], fmm->radius[child] + sqrt(dx * dx + dy * dy + dz * dz));
+                fmm->targets[id] += fmm->targets[child];
+            }
+            // The cube itself also bounds the bodies, which is tighter when the centre of mass is near its centre
+            double dx = node->mass_x - node->centre_x;
+            double dy = node->mass_y - node->centre_y;
+            double dz = node->mass_z - node->centre_z;
+            fmm->radius[id] = fmin(fmm->radius[id], sqrt(3.0) * node->half_size + sqrt(dx * dx + dy * dy + dz * dz));
+        }
+    }
+}
+
+/*
+ * Walk pairs of (target node, source node) from (root, root)
+ * Well separated pairs are converted into a local expansion of the target, pairs of leaves are summed body by body,
+ * and otherwise the bigger node of the pair is split into its octants
+ */
+static void dual_tree_walk(struct fast_multipole *fmm, struct barnes_hut_tree *tree, double theta) {
+    int top = 0;
+    push_pair(fmm, &top, 0, 0);
+    while (top > 0) {
+        top--;
+        int a = fmm->pairs[2 * top], b = fmm->pairs[2 * top + 1];
+        struct barnes_hut_node *target = &tree->nodes[a], *source = &tree->nodes[b];
+        if (fmm->targets[a] == 0 || source->mass == 0) continue;
+        if (a == b) {
+            if (target->leaf) {
+                particle_to_particle(fmm, tree, a, b);
+            } else {
+                for (int i = 0; i < 8; i++) {
+                    if (target->children[i] < 0) continue;
+                    for (int j = 0; j < 8; j++) {
+                        if (target->children[j] >= 0) push_pair(fmm, &top, target->children[i], target->children[j]);
+                    }
+                }
+            }
+            continue;
+        }
+        double dx = target->mass_x - source->mass_x;
+        double dy = target->mass_y - source->mass_y;
+        double dz = target->mass_z - source->mass_z;
+        double distance = sqrt(dx * dx + dy * dy + dz * dz);
+        if (fmm->radius[a] + fmm->radius[b] < theta * distance) {
+            multipole_to_local(fmm, tree, a, b);
+        } else if (target->leaf && source->leaf) {
+            particle_to_particle(fmm, tree, a, b);
+        } else if (source->leaf || (!target->leaf && fmm->radius[a] > fmm->radius[b])) {
+            for (int i = 0; i < 8; i++) {
+                if (target->children[i] >= 0) push_pair(fmm, &top, target->children[i], b);
+            }
+        } else {
+            for (int j = 0; j < 8; j++) {
+                if (source->children[j] >= 0) push_pair(fmm, &top, a, source->children[j]);
+            }
+        }
+    }
+}
+
+/*
+ * Shift local expansions down to the octants, and evaluate the gradient of the local expansion of every leaf at its
+ * target bodies
+ * Nodes are created before their octants, so walking them forwards visits parents first
+ */
+static void downward_pass(struct fast_multipole *fmm, struct barnes_hut_tree *tree) {
+    double power[fmm->terms];
+    for (int id = 0; id < tree->node_count; id++) {
+        struct barnes_hut_node *node = &tree->nodes[id];
+        double *local = &fmm->locals[fmm->terms * id];
+        if (fmm->targets[id] == 0) continue;
+        if (!node->leaf) {
+            for (int k = 0; k < 8; k++) {
+                int child = node->children[k];
+                if (child < 0 || fmm->targets[child] == 0) continue;
+                powers(fmm, tree->nodes[child].mass_x - node->mass_x, tree->nodes[child].mass_y - node->mass_y,
+                       tree->nodes[child].mass_z - node->mass_z, power);
+                double *child_local = &fmm->locals[fmm->terms * child];
+                for (int s = 0; s < fmm->shift_count; s++) {
+                    child_local[fmm->shift_small[s]] += fmm->shift_coefficient[s] * power[fmm->shift_power[s]] *
+                                                        local[fmm->shift_big[s]];
+                }
+            }
+            continue;
+        }
+        for (int i = node->first; i < node->last; i++) {
+            if (!fmm->target[i]) continue;
+            powers(fmm, tree->sorted.x[i] - node->mass_x, tree->sorted.y[i] - node->mass_y,
+                   tree->sorted.z[i] - node->mass_z, power);
+            // d/dx (x - centre)^k = k_x (x - centre)^(k - e_x), and likewise for y and z
+            double ax = 0, ay = 0, az = 0;
+            for (int k = 1; k < fmm->terms; k++) {
+                int *e = &fmm->exponents[3 * k], *lower = &fmm->lower[3 * k];
+                if (e[0] > 0) ax += local[k] * e[0] * power[lower[0]];
+                if (e[1] > 0) ay += local[k] * e[1] * power[lower[1]];
+                if (e[2] > 0) az += local[k] * e[2] * power[lower[2]];
+            }
+            fmm->acceleration_x[i] += ax;
+            fmm->acceleration_y[i] += ay;
+            fmm->acceleration_z[i] += az;
+        }
+    }
+}
+
+/*
+ * Push a pair of nodes on the walk stack, doubling it when full
+ */
+static void push_pair(struct fast_multipole *fmm, int *top, int target, int source) {
+    if (*top == fmm->pair_capacity) {
+        fmm->pair_capacity *= 2;
+        fmm->pairs = (int *) realloc(fmm->pairs, sizeof(int) * 2 * fmm->pair_capacity);
+    }
+    fmm->pairs[2 * *top] = target;
+    fmm->pairs[2 * *top + 1] = source;
+    (*top)++;
+}
+
+/*
+ * Add the multipole expansion of the source node to the local expansion of the target node
+ */
+static void multipole_to_local(struct fast_multipole *fmm, struct barnes_hut_tree *tree, int target, int source) {
+    double taylor[fmm->terms];
+    taylor_coefficients(fmm, tree->nodes[target].mass_x - tree->nodes[source].mass_x,
+                        tree->nodes[target].mass_y - tree->nodes[source].mass_y,
+                        tree->nodes[target].mass_z - tree->nodes[source].mass_z, taylor);
+    double *local = &fmm->locals[fmm->terms * target];
+    double *multipole = &fmm->multipoles[fmm->terms * source];
+    for (int c = 0; c < fmm->convert_count; c++) {
+        local[fmm->convert_local[c]] += fmm->convert_coefficient[c] * taylor[fmm->convert_taylor[c]] *
+                                        multipole[fmm->convert_multipole[c]];
+    }
+}
+
+/*
+ * Sum the bodies of the source leaf directly on the target bodies of the target leaf
+ */
+static void particle_to_particle(struct fast_multipole *fmm, struct barnes_hut_tree *tree, int target, int source) {
+    struct barnes_hut_node *source_node = &tree->nodes[source];
+    for (int i = tree->nodes[target].first; i < tree->nodes[target].last; i++) {
+        if (!fmm->target[i]) continue;
+        double acceleration[3] = {0, 0, 0};
+        accumulate_acceleration(tree->sorted.x[i], tree->sorted.y[i], tree->sorted.z[i], &tree->sorted,
+                                source_node->first, source_node->last, acceleration);
+        fmm->acceleration_x[i] += acceleration[0];
+        fmm->acceleration_y[i] += acceleration[1];
+        fmm->acceleration_z[i] += acceleration[2];
+    }
+}
+
+/*
+ * (dx, dy, dz)^n for every term n
+ */
+static void powers(struct fast_multipole *fmm, double dx, double dy, double dz, double *power) {
+    power[0] = 1;
+    for (int t = 1; t < fmm->terms; t++) {
+        int *lower = &fmm->lower[3 * t];
+        if (lower[0] >= 0) power[t] = power[lower[0]] * dx;
+        else if (lower[1] >= 0) power[t] = power[lower[1]] * dy;
+        else power[t] = power[lower[2]] * dz;
+    }
+}
+
+/*
+ * Taylor coefficients T_k = D^k f(R) / k! of f(R) = 1 / |R| for every term k, from the recurrence
+ * |k| |R|^2 T_k + (2|k| - 1) sum_i R_i T_(k - e_i) + (|k| - 1) sum_i T_(k - 2e_i) = 0
+ * Reference: Duan, Z.-H. and Krasny, R. (2001). "An adaptive treecode for computing nonbonded potential energy in
+ * classical molecular systems". Journal of Computational Chemistry. 22 (2): 184-195.
+ */
+static void taylor_coefficients(struct fast_multipole *fmm, double rx, double ry, double rz, double *taylor) {
+    double r2 = rx * rx + ry * ry + rz * rz;
+    double r[3] = {rx, ry, rz};
+    taylor[0] = 1 / sqrt(r2);
+    for (int t = 1; t < fmm->terms; t++) {
+        int *e = &fmm->exponents[3 * t];
+        int degree = e[0] + e[1] + e[2];
+        double first = 0, second = 0;
+        for (int i = 0; i < 3; i++) {
+            if (fmm->lower[3 * t + i] >= 0) first += r[i] * taylor[fmm->lower[3 * t + i]];
+            if (fmm->lower_twice[3 * t + i] >= 0) second += taylor[fmm->lower_twice[3 * t + i]];
+        }
+        taylor[t] = -((2 * degree - 1) * first + (degree - 1) * second) / (degree * r2);
+    }
+}
+
+/*
+ * Binomial coefficient n choose k, for the small numbers used by the expansions
+ */
+static double binomial(int n, int k) {
+    double result = 1;
+    for (int i = 1; i <= k; i++) result = result * (n - k + i) / i;
+    return result;
+}
+
+/*
+ * Index of the term with exponents (a, b, c)
+ */
+static int term(struct fast_multipole *fmm, int a, int b, int c) {
+    return fmm->index_of[(a * (fmm->order + 1) + b) * (fmm->order + 1) + c];
+}
@@ -0,0 +1,47 @@
+#ifndef FAST_MULTIPOLE_INCLUDE
+#define FAST_MULTIPOLE_INCLUDE
+
+#include <stdbool.h>
+#include "barnes_hut.h"
+
+// Highest expansion order supported by the fast multipole solver
+#define FAST_MULTIPOLE_MAX_ORDER 10
+
+// Maximum number of bodies kept in a leaf of the octree used by the fast multipole solver
+#define FAST_MULTIPOLE_LEAF_SIZE 64
+
+/*
+ * Cartesian fast multipole method on the Barnes-Hut octree
+ * Expansions are truncated Taylor series in multi-indices n = (a, b, c) with a + b + c <= order, stored in degree order
+ * Every node has a multipole expansion about its centre of mass, M_n = sum(m * (y - centre)^n) over its bodies, and a
+ * local expansion about the same point, so that the potential sum(m / |x - y|) near it is sum(L_k * (x - centre)^k)
+ */
+struct fast_multipole {
+    int order, terms;
+    int *exponents; // three exponents per term
+    int *index_of; // term of (a, b, c) at [(a * (order + 1) + b) * (order + 1) + c], -1 above the order
+    int *lower; // per term k and axis i, the term of k - e_i or -1
+    int *lower_twice; // per term k and axis i, the term of k - 2e_i or -1
+    // Pairs (n, m <= n) used to shift expansions between a node and its octants: coefficient C(n, m), term of n - m
+    int shift_count;
+    int *shift_big, *shift_small, *shift_power;
+    double *shift_coefficient;
+    // Pairs (k, n) with |k| + |n| <= order used to convert a multipole into a local expansion
+    int convert_count;
+    int *convert_local, *convert_multipole, *convert_taylor;
+    double *convert_coefficient;
+    int node_capacity;
+    double *multipoles, *locals; // terms doubles per node
+    double *radius; // per node, distance from the centre of mass to the furthest body
+    int *targets; // per node, number of bodies whose acceleration this process needs
+    int *pairs; // stack of node pairs of the dual tree walk
+    int pair_capacity;
+    bool *target; // per sorted body, whether its acceleration is needed
+    double *acceleration_x, *acceleration_y, *acceleration_z; // per sorted body
+};
+
+void allocate_fast_multipole(struct fast_multipole *, int, int);
+
+void fast_multipole_accelerations(struct fast_multipole *, struct barnes_hut_tree *, double, int, int);
+
+#endif
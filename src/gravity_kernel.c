@@ -0,0 +1,478 @@
+#include "gravity_kernel.h"
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define GRAVITY_KERNEL_X86 1
+#endif
+
+/*
+ * A kernel adds the acceleration (without the gravitational constant) caused by sources[first, last) on a point
+ */
+typedef void (*gravity_kernel)(double, double, double, struct gravity_sources *, int, int, double *);
+
+/*
+ * A contact kernel does the same and also records the sources closer to the point than the given distance, returning
+ * their number
+ */
+typedef int (*gravity_contact_kernel)(double, double, double, double, struct gravity_sources *, int, int, double *,
+                                      int *);
+
+/*
+ * A pair kernel does the same for a source of the given mass at the point, and also subtracts the opposite
+ * acceleration (without the gravitational constant) from each of sources[first, last)
+ */
+typedef void (*gravity_pair_kernel)(double, double, double, double, struct gravity_sources *, int, int, double *,
+                                    double *, double *, double *);
+
+static void accumulate_acceleration_scalar(double, double, double, struct gravity_sources *, int, int, double *);
+
+static int accumulate_acceleration_contacts_scalar(double, double, double, double, struct gravity_sources *, int, int,
+                                                  double *, int *);
+
+static void accumulate_pair_row_scalar(double, double, double, double, struct gravity_sources *, int, int, double *,
+                                       double *, double *, double *);
+
+static gravity_kernel selected_kernel = &accumulate_acceleration_scalar;
+static gravity_contact_kernel selected_contact_kernel = &accumulate_acceleration_contacts_scalar;
+static gravity_pair_kernel selected_pair_kernel = &accumulate_pair_row_scalar;
+static const char *selected_kernel_name = "scalar";
+
+/*
+ * Allocate packed arrays for up to capacity sources
+ */
+void allocate_gravity_sources(struct gravity_sources *sources, int capacity) {
+    sources->count = 0;
+    sources->index = (int *) malloc(sizeof(int) * capacity);
+    sources->x = (double *) malloc(sizeof(double) * capacity);
+    sources->y = (double *) malloc(sizeof(double) * capacity);
+    sources->z = (double *) malloc(sizeof(double) * capacity);
+    sources->mass = (double *) malloc(sizeof(double) * capacity);
+    sources->velocity_x = NULL;
+    sources->velocity_y = NULL;
+    sources->velocity_z = NULL;
+}
+
+/*
+ * Allocate the velocities of up to capacity sources, which only the jerk needs
+ */
+void allocate_gravity_source_velocities(struct gravity_sources *sources, int capacity) {
+    sources->velocity_x = (double *) malloc(sizeof(double) * capacity);
+    sources->velocity_y = (double *) malloc(sizeof(double) * capacity);
+    sources->velocity_z = (double *) malloc(sizeof(double) * capacity);
+}
+
+/*
+ * Accumulates sum(m * d / |d|^3) over the sources, where d is the vector from the point to a source
+ * This is the interaction that used to be computed pair by pair in calculate_two_body_acceleration, which was based
+ * on http://www.cyber-omelette.com/2016/11/python-n-body-orbital-simulation.html
+ * A source at exactly the same position as the point (i.e. the point itself) contributes nothing
+ * The caller multiplies the result by the gravitational constant
+ */
+void accumulate_acceleration(double x, double y, double z, struct gravity_sources *sources, int first, int last,
+                             double *acceleration) {
+    selected_kernel(x, y, z, sources, first, last, acceleration);
+}
+
+/*
+ * Accumulates the acceleration like accumulate_acceleration, and records in contacts the sources closer to the point
+ * than the given distance, comparing the squared distances so that no square root is taken. The point itself is
+ * recorded as well
+ * contacts must hold last - first entries, the number recorded is returned
+ */
+int accumulate_acceleration_contacts(double x, double y, double z, double distance, struct gravity_sources *sources,
+                                     int first, int last, double *acceleration, int *contacts) {
+    return selected_contact_kernel(x, y, z, distance * distance, sources, first, last, acceleration, contacts);
+}
+
+/*
+ * Accumulates the acceleration sum(m * d / |d|^3) and its time derivative, the jerk
+ * sum(m * (w / |d|^3 - 3 * (d . w) * d / |d|^5)), over the sources, where d and w are the position and velocity of a
+ * source relative to the point given by its position and velocity
+ * The sources must have their velocities packed, a source at exactly the same position as the point contributes nothing
+ * The caller multiplies both results by the gravitational constant
+ */
+void accumulate_acceleration_jerk(double *position, double *velocity, struct gravity_sources *sources, int first,
+                                  int last, double *acceleration, double *jerk) {
+    double ax = 0, ay = 0, az = 0, jx = 0, jy = 0, jz = 0;
+    for (int i = first; i < last; i++) {
+        double dx = sources->x[i] - position[0];
+        double dy = sources->y[i] - position[1];
+        double dz = sources->z[i] - position[2];
+        double r2 = dx * dx + dy * dy + dz * dz;
+        if (r2 > 0) {
+            double wx = sources->velocity_x[i] - velocity[0];
+            double wy = sources->velocity_y[i] - velocity[1];
+            double wz = sources->velocity_z[i] - velocity[2];
+            double tmp = sources->mass[i] / (r2 * sqrt(r2));
+            double rate = 3 * (dx * wx + dy * wy + dz * wz) / r2;
+            ax += tmp * dx;
+            ay += tmp * dy;
+            az += tmp * dz;
+            jx += tmp * (wx - rate * dx);
+            jy += tmp * (wy - rate * dy);
+            jz += tmp * (wz - rate * dz);
+        }
+    }
+    acceleration[0] += ax;
+    acceleration[1] += ay;
+    acceleration[2] += az;
+    jerk[0] += jx;
+    jerk[1] += jy;
+    jerk[2] += jz;
+}
+
+/*
+ * Evaluates the pairs between a point of the given mass and sources[first, last) once, for Newton's third law
+ * The point gains sum(m_j * d / |d|^3) in acceleration, and source j loses mass * d / |d|^3 in the three arrays
+ */
+void accumulate_pair_row(double x, double y, double z, double mass, struct gravity_sources *sources, int first,
+                         int last, double *acceleration, double *acceleration_x, double *acceleration_y,
+                         double *acceleration_z) {
+    selected_pair_kernel(x, y, z, mass, sources, first, last, acceleration, acceleration_x, acceleration_y,
+                         acceleration_z);
+}
+
+static void accumulate_acceleration_scalar(double x, double y, double z, struct gravity_sources *sources, int first,
+                                           int last, double *acceleration) {
+    double ax = 0, ay = 0, az = 0;
+    for (int i = first; i < last; i++) {
+        double dx = sources->x[i] - x;
+        double dy = sources->y[i] - y;
+        double dz = sources->z[i] - z;
+        double r2 = dx * dx + dy * dy + dz * dz;
+        if (r2 > 0) {
+            double tmp = sources->mass[i] / (r2 * sqrt(r2));
+            ax += tmp * dx;
+            ay += tmp * dy;
+            az += tmp * dz;
+        }
+    }
+    acceleration[0] += ax;
+    acceleration[1] += ay;
+    acceleration[2] += az;
+}
+
+static int accumulate_acceleration_contacts_scalar(double x, double y, double z, double distance2,
+                                                  struct gravity_sources *sources, int first, int last,
+                                                  double *acceleration, int *contacts) {
+    double ax = 0, ay = 0, az = 0;
+    int found = 0;
+    for (int i = first; i < last; i++) {
+        double dx = sources->x[i] - x;
+        double dy = sources->y[i] - y;
+        double dz = sources->z[i] - z;
+        double r2 = dx * dx + dy * dy + dz * dz;
+        if (r2 < distance2) contacts[found++] = i;
+        if (r2 > 0) {
+            double tmp = sources->mass[i] / (r2 * sqrt(r2));
+            ax += tmp * dx;
+            ay += tmp * dy;
+            az += tmp * dz;
+        }
+    }
+    acceleration[0] += ax;
+    acceleration[1] += ay;
+    acceleration[2] += az;
+    return found;
+}
+
+static void accumulate_pair_row_scalar(double x, double y, double z, double mass, struct gravity_sources *sources,
+                                       int first, int last, double *acceleration, double *acceleration_x,
+                                       double *acceleration_y, double *acceleration_z) {
+    double ax = 0, ay = 0, az = 0;
+    for (int j = first; j < last; j++) {
+        double dx = sources->x[j] - x;
+        double dy = sources->y[j] - y;
+        double dz = sources->z[j] - z;
+        double r2 = dx * dx + dy * dy + dz * dz;
+        if (r2 > 0) {
+            double inv3 = 1.0 / (r2 * sqrt(r2));
+            ax += sources->mass[j] * inv3 * dx;
+            ay += sources->mass[j] * inv3 * dy;
+            az += sources->mass[j] * inv3 * dz;
+            acceleration_x[j] -= mass * inv3 * dx;
+            acceleration_y[j] -= mass * inv3 * dy;
+            acceleration_z[j] -= mass * inv3 * dz;
+        }
+    }
+    acceleration[0] += ax;
+    acceleration[1] += ay;
+    acceleration[2] += az;
+}
+
+#ifdef GRAVITY_KERNEL_X86
+/*
+ * AVX2 has no double precision reciprocal square root, so the estimate is taken in single precision (12 bits) and
+ * three Newton steps y = y * (1.5 - 0.5 * r2 * y * y) bring it to double precision
+ * Squared distances in the solar system (at most ~1e26 m^2) are well within the single precision range
+ */
+__attribute__((target("avx2,fma")))
+static void accumulate_acceleration_avx2(double x, double y, double z, struct gravity_sources *sources, int first,
+                                         int last, double *acceleration) {
+    __m256d px = _mm256_set1_pd(x), py = _mm256_set1_pd(y), pz = _mm256_set1_pd(z);
+    __m256d half = _mm256_set1_pd(0.5), three_halves = _mm256_set1_pd(1.5), zero = _mm256_setzero_pd();
+    __m256d ax = zero, ay = zero, az = zero;
+    int i = first;
+    for (; i + 4 <= last; i += 4) {
+        __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(&sources->x[i]), px);
+        __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(&sources->y[i]), py);
+        __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(&sources->z[i]), pz);
+        __m256d r2 = _mm256_fmadd_pd(dz, dz, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dx, dx)));
+        __m256d inv = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r2)));
+        __m256d half_r2 = _mm256_mul_pd(half, r2);
+        inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(half_r2, _mm256_mul_pd(inv, inv), three_halves));
+        inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(half_r2, _mm256_mul_pd(inv, inv), three_halves));
+        inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(half_r2, _mm256_mul_pd(inv, inv), three_halves));
+        // Drop the point itself, whose infinite estimate would otherwise turn into NaN
+        inv = _mm256_and_pd(inv, _mm256_cmp_pd(r2, zero, _CMP_GT_OQ));
+        __m256d tmp = _mm256_mul_pd(_mm256_loadu_pd(&sources->mass[i]), _mm256_mul_pd(inv, _mm256_mul_pd(inv, inv)));
+        ax = _mm256_fmadd_pd(tmp, dx, ax);
+        ay = _mm256_fmadd_pd(tmp, dy, ay);
+        az = _mm256_fmadd_pd(tmp, dz, az);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, ax);
+    acceleration[0] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm256_storeu_pd(lanes, ay);
+    acceleration[1] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm256_storeu_pd(lanes, az);
+    acceleration[2] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    accumulate_acceleration_scalar(x, y, z, sources, i, last, acceleration);
+}
+
+/*
+ * The distances are compared in the vector registers and only the lanes that are close enough are looked at one by one
+ */
+__attribute__((target("avx2,fma")))
+static int accumulate_acceleration_contacts_avx2(double x, double y, double z, double distance2,
+                                                struct gravity_sources *sources, int first, int last,
+                                                double *acceleration, int *contacts) {
+    __m256d px = _mm256_set1_pd(x), py = _mm256_set1_pd(y), pz = _mm256_set1_pd(z), pd = _mm256_set1_pd(distance2);
+    __m256d half = _mm256_set1_pd(0.5), three_halves = _mm256_set1_pd(1.5), zero = _mm256_setzero_pd();
+    __m256d ax = zero, ay = zero, az = zero;
+    int found = 0;
+    int i = first;
+    for (; i + 4 <= last; i += 4) {
+        __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(&sources->x[i]), px);
+        __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(&sources->y[i]), py);
+        __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(&sources->z[i]), pz);
+        __m256d r2 = _mm256_fmadd_pd(dz, dz, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dx, dx)));
+        int close = _mm256_movemask_pd(_mm256_cmp_pd(r2, pd, _CMP_LT_OQ));
+        while (close) {
+            contacts[found++] = i + __builtin_ctz(close);
+            close &= close - 1;
+        }
+        __m256d inv = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r2)));
+        __m256d half_r2 = _mm256_mul_pd(half, r2);
+        inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(half_r2, _mm256_mul_pd(inv, inv), three_halves));
+        inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(half_r2, _mm256_mul_pd(inv, inv), three_halves));
+        inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(half_r2, _mm256_mul_pd(inv, inv), three_halves));
+        inv = _mm256_and_pd(inv, _mm256_cmp_pd(r2, zero, _CMP_GT_OQ));
+        __m256d tmp = _mm256_mul_pd(_mm256_loadu_pd(&sources->mass[i]), _mm256_mul_pd(inv, _mm256_mul_pd(inv, inv)));
+        ax = _mm256_fmadd_pd(tmp, dx, ax);
+        ay = _mm256_fmadd_pd(tmp, dy, ay);
+        az = _mm256_fmadd_pd(tmp, dz, az);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, ax);
+    acceleration[0] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm256_storeu_pd(lanes, ay);
+    acceleration[1] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm256_storeu_pd(lanes, az);
+    acceleration[2] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    return found + accumulate_acceleration_contacts_scalar(x, y, z, distance2, sources, i, last, acceleration,
+                                                           &contacts[found]);
+}
+
+__attribute__((target("avx2,fma")))
+static void accumulate_pair_row_avx2(double x, double y, double z, double mass, struct gravity_sources *sources,
+                                     int first, int last, double *acceleration, double *acceleration_x,
+                                     double *acceleration_y, double *acceleration_z) {
+    __m256d px = _mm256_set1_pd(x), py = _mm256_set1_pd(y), pz = _mm256_set1_pd(z), pm = _mm256_set1_pd(mass);
+    __m256d half = _mm256_set1_pd(0.5), three_halves = _mm256_set1_pd(1.5), zero = _mm256_setzero_pd();
+    __m256d ax = zero, ay = zero, az = zero;
+    int j = first;
+    for (; j + 4 <= last; j += 4) {
+        __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(&sources->x[j]), px);
+        __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(&sources->y[j]), py);
+        __m256d dz = _mm256_sub_pd(_mm256_loadu_pd(&sources->z[j]), pz);
+        __m256d r2 = _mm256_fmadd_pd(dz, dz, _mm256_fmadd_pd(dy, dy, _mm256_mul_pd(dx, dx)));
+        __m256d inv = _mm256_cvtps_pd(_mm_rsqrt_ps(_mm256_cvtpd_ps(r2)));
+        __m256d half_r2 = _mm256_mul_pd(half, r2);
+        inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(half_r2, _mm256_mul_pd(inv, inv), three_halves));
+        inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(half_r2, _mm256_mul_pd(inv, inv), three_halves));
+        inv = _mm256_mul_pd(inv, _mm256_fnmadd_pd(half_r2, _mm256_mul_pd(inv, inv), three_halves));
+        inv = _mm256_and_pd(inv, _mm256_cmp_pd(r2, zero, _CMP_GT_OQ));
+        __m256d inv3 = _mm256_mul_pd(inv, _mm256_mul_pd(inv, inv));
+        __m256d tmp = _mm256_mul_pd(_mm256_loadu_pd(&sources->mass[j]), inv3);
+        ax = _mm256_fmadd_pd(tmp, dx, ax);
+        ay = _mm256_fmadd_pd(tmp, dy, ay);
+        az = _mm256_fmadd_pd(tmp, dz, az);
+        tmp = _mm256_mul_pd(pm, inv3);
+        _mm256_storeu_pd(&acceleration_x[j], _mm256_fnmadd_pd(tmp, dx, _mm256_loadu_pd(&acceleration_x[j])));
+        _mm256_storeu_pd(&acceleration_y[j], _mm256_fnmadd_pd(tmp, dy, _mm256_loadu_pd(&acceleration_y[j])));
+        _mm256_storeu_pd(&acceleration_z[j], _mm256_fnmadd_pd(tmp, dz, _mm256_loadu_pd(&acceleration_z[j])));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, ax);
+    acceleration[0] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm256_storeu_pd(lanes, ay);
+    acceleration[1] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    _mm256_storeu_pd(lanes, az);
+    acceleration[2] += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    accumulate_pair_row_scalar(x, y, z, mass, sources, j, last, acceleration, acceleration_x, acceleration_y,
+                               acceleration_z);
+}
+
+/*
+ * AVX-512 provides a 14 bit double precision estimate, two Newton steps are enough to reach double precision
+ */
+__attribute__((target("avx512f")))
+static void accumulate_acceleration_avx512(double x, double y, double z, struct gravity_sources *sources, int first,
+                                           int last, double *acceleration) {
+    __m512d px = _mm512_set1_pd(x), py = _mm512_set1_pd(y), pz = _mm512_set1_pd(z);
+    __m512d half = _mm512_set1_pd(0.5), three_halves = _mm512_set1_pd(1.5), zero = _mm512_setzero_pd();
+    __m512d ax = zero, ay = zero, az = zero;
+    int i = first;
+    for (; i + 8 <= last; i += 8) {
+        __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(&sources->x[i]), px);
+        __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(&sources->y[i]), py);
+        __m512d dz = _mm512_sub_pd(_mm512_loadu_pd(&sources->z[i]), pz);
+        __m512d r2 = _mm512_fmadd_pd(dz, dz, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dx, dx)));
+        // Drop the point itself, whose infinite estimate would otherwise turn into NaN
+        __mmask8 distinct = _mm512_cmp_pd_mask(r2, zero, _CMP_GT_OQ);
+        __m512d inv = _mm512_maskz_rsqrt14_pd(distinct, r2);
+        __m512d half_r2 = _mm512_mul_pd(half, r2);
+        inv = _mm512_mul_pd(inv, _mm512_fnmadd_pd(half_r2, _mm512_mul_pd(inv, inv), three_halves));
+        inv = _mm512_mul_pd(inv, _mm512_fnmadd_pd(half_r2, _mm512_mul_pd(inv, inv), three_halves));
+        __m512d tmp = _mm512_mul_pd(_mm512_loadu_pd(&sources->mass[i]), _mm512_mul_pd(inv, _mm512_mul_pd(inv, inv)));
+        ax = _mm512_fmadd_pd(tmp, dx, ax);
+        ay = _mm512_fmadd_pd(tmp, dy, ay);
+        az = _mm512_fmadd_pd(tmp, dz, az);
+    }
+    acceleration[0] += _mm512_reduce_add_pd(ax);
+    acceleration[1] += _mm512_reduce_add_pd(ay);
+    acceleration[2] += _mm512_reduce_add_pd(az);
+    accumulate_acceleration_scalar(x, y, z, sources, i, last, acceleration);
+}
+
+__attribute__((target("avx512f")))
+static int accumulate_acceleration_contacts_avx512(double x, double y, double z, double distance2,
+                                                  struct gravity_sources *sources, int first, int last,
+                                                  double *acceleration, int *contacts) {
+    __m512d px = _mm512_set1_pd(x), py = _mm512_set1_pd(y), pz = _mm512_set1_pd(z), pd = _mm512_set1_pd(distance2);
+    __m512d half = _mm512_set1_pd(0.5), three_halves = _mm512_set1_pd(1.5), zero = _mm512_setzero_pd();
+    __m512d ax = zero, ay = zero, az = zero;
+    int found = 0;
+    int i = first;
+    for (; i + 8 <= last; i += 8) {
+        __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(&sources->x[i]), px);
+        __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(&sources->y[i]), py);
+        __m512d dz = _mm512_sub_pd(_mm512_loadu_pd(&sources->z[i]), pz);
+        __m512d r2 = _mm512_fmadd_pd(dz, dz, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dx, dx)));
+        unsigned int close = _mm512_cmp_pd_mask(r2, pd, _CMP_LT_OQ);
+        while (close) {
+            contacts[found++] = i + __builtin_ctz(close);
+            close &= close - 1;
+        }
+        __mmask8 distinct = _mm512_cmp_pd_mask(r2, zero, _CMP_GT_OQ);
+        __m512d inv = _mm512_maskz_rsqrt14_pd(distinct, r2);
+        __m512d half_r2 = _mm512_mul_pd(half, r2);
+        inv = _mm512_mul_pd(inv, _mm512_fnmadd_pd(half_r2, _mm512_mul_pd(inv, inv), three_halves));
+        inv = _mm512_mul_pd(inv, _mm512_fnmadd_pd(half_r2, _mm512_mul_pd(inv, inv), three_halves));
+        __m512d tmp = _mm512_mul_pd(_mm512_loadu_pd(&sources->mass[i]), _mm512_mul_pd(inv, _mm512_mul_pd(inv, inv)));
+        ax = _mm512_fmadd_pd(tmp, dx, ax);
+        ay = _mm512_fmadd_pd(tmp, dy, ay);
+        az = _mm512_fmadd_pd(tmp, dz, az);
+    }
+    acceleration[0] += _mm512_reduce_add_pd(ax);
+    acceleration[1] += _mm512_reduce_add_pd(ay);
+    acceleration[2] += _mm512_reduce_add_pd(az);
+    return found + accumulate_acceleration_contacts_scalar(x, y, z, distance2, sources, i, last, acceleration,
+                                                           &contacts[found]);
+}
+
+__attribute__((target("avx512f")))
+static void accumulate_pair_row_avx512(double x, double y, double z, double mass, struct gravity_sources *sources,
+                                       int first, int last, double *acceleration, double *acceleration_x,
+                                       double *acceleration_y, double *acceleration_z) {
+    __m512d px = _mm512_set1_pd(x), py = _mm512_set1_pd(y), pz = _mm512_set1_pd(z), pm = _mm512_set1_pd(mass);
+    __m512d half = _mm512_set1_pd(0.5), three_halves = _mm512_set1_pd(1.5), zero = _mm512_setzero_pd();
+    __m512d ax = zero, ay = zero, az = zero;
+    int j = first;
+    for (; j + 8 <= last; j += 8) {
+        __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(&sources->x[j]), px);
+        __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(&sources->y[j]), py);
+        __m512d dz = _mm512_sub_pd(_mm512_loadu_pd(&sources->z[j]), pz);
+        __m512d r2 = _mm512_fmadd_pd(dz, dz, _mm512_fmadd_pd(dy, dy, _mm512_mul_pd(dx, dx)));
+        __mmask8 distinct = _mm512_cmp_pd_mask(r2, zero, _CMP_GT_OQ);
+        __m512d inv = _mm512_maskz_rsqrt14_pd(distinct, r2);
+        __m512d half_r2 = _mm512_mul_pd(half, r2);
+        inv = _mm512_mul_pd(inv, _mm512_fnmadd_pd(half_r2, _mm512_mul_pd(inv, inv), three_halves));
+        inv = _mm512_mul_pd(inv, _mm512_fnmadd_pd(half_r2, _mm512_mul_pd(inv, inv), three_halves));
+        __m512d inv3 = _mm512_mul_pd(inv, _mm512_mul_pd(inv, inv));
+        __m512d tmp = _mm512_mul_pd(_mm512_loadu_pd(&sources->mass[j]), inv3);
+        ax = _mm512_fmadd_pd(tmp, dx, ax);
+        ay = _mm512_fmadd_pd(tmp, dy, ay);
+        az = _mm512_fmadd_pd(tmp, dz, az);
+        tmp = _mm512_mul_pd(pm, inv3);
+        _mm512_storeu_pd(&acceleration_x[j], _mm512_fnmadd_pd(tmp, dx, _mm512_loadu_pd(&acceleration_x[j])));
+        _mm512_storeu_pd(&acceleration_y[j], _mm512_fnmadd_pd(tmp, dy, _mm512_loadu_pd(&acceleration_y[j])));
+        _mm512_storeu_pd(&acceleration_z[j], _mm512_fnmadd_pd(tmp, dz, _mm512_loadu_pd(&acceleration_z[j])));
+    }
+    acceleration[0] += _mm512_reduce_add_pd(ax);
+    acceleration[1] += _mm512_reduce_add_pd(ay);
+    acceleration[2] += _mm512_reduce_add_pd(az);
+    accumulate_pair_row_scalar(x, y, z, mass, sources, j, last, acceleration, acceleration_x, acceleration_y,
+                               acceleration_z);
+}
+#endif
+
+/*
+ * Pick the widest kernel the processor running the program supports
+ * The binary is built for the baseline instruction set, so this must be called once before the simulation starts
+ */
+void select_gravity_kernel() {
+#ifdef GRAVITY_KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        selected_kernel = &accumulate_acceleration_avx512;
+        selected_contact_kernel = &accumulate_acceleration_contacts_avx512;
+        selected_pair_kernel = &accumulate_pair_row_avx512;
+        selected_kernel_name = "avx512";
+        return;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        selected_kernel = &accumulate_acceleration_avx2;
+        selected_contact_kernel = &accumulate_acceleration_contacts_avx2;
+        selected_pair_kernel = &accumulate_pair_row_avx2;
+        selected_kernel_name = "avx2";
+        return;
+    }
+#endif
+    selected_kernel = &accumulate_acceleration_scalar;
+    selected_contact_kernel = &accumulate_acceleration_contacts_scalar;
+    selected_pair_kernel = &accumulate_pair_row_scalar;
+    selected_kernel_name = "scalar";
+}
+
+/*
+ * Name of the kernel in use, for reporting
+ */
+const char *gravity_kernel_name() {
+    return selected_kernel_name;
+}
+
+/*
+ * Number of sources per tile of the tiled direct summation, so that the packed positions and masses of a tile take
+ * half of the L1 data cache and stay there while every target of the process is summed against them
+ */
+int gravity_tile_size() {
+    long int cache_size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+    if (cache_size <= 0) cache_size = 32768; // unknown, assume a small L1
+    int tile_size = (int) (cache_size / 2 / (4 * sizeof(double)));
+    return tile_size < 256 ? 256 : tile_size;
+}
@@ -0,0 +1,36 @@
+#ifndef GRAVITY_KERNEL_INCLUDE
+#define GRAVITY_KERNEL_INCLUDE
+
+/*
+ * Bodies that act upon others through gravity, packed contiguously so that a block of them can be streamed by the
+ * vectorised kernel without touching inactive bodies
+ */
+struct gravity_sources {
+    int count;
+    int *index; // index of each source in the body store
+    double *x, *y, *z;
+    double *mass;
+    double *velocity_x, *velocity_y, *velocity_z; // only packed for the Hermite integrator, NULL otherwise
+};
+
+void allocate_gravity_sources(struct gravity_sources *, int);
+
+void allocate_gravity_source_velocities(struct gravity_sources *, int);
+
+void select_gravity_kernel();
+
+const char *gravity_kernel_name();
+
+int gravity_tile_size();
+
+void accumulate_acceleration(double, double, double, struct gravity_sources *, int, int, double *);
+
+int accumulate_acceleration_contacts(double, double, double, double, struct gravity_sources *, int, int, double *,
+                                     int *);
+
+void accumulate_acceleration_jerk(double *, double *, struct gravity_sources *, int, int, double *, double *);
+
+void accumulate_pair_row(double, double, double, double, struct gravity_sources *, int, int, double *, double *,
+                         double *, double *);
+
+#endif
@@ -0,0 +1,88 @@
+#include "kepler.h"
+#include <math.h>
+
+static void stumpff(double, double *);
+
+/*
+ * Moves a body along its two-body orbit around a central mass for the given time
+ * The position and velocity are relative to the central body, mu is the gravitational constant times its mass
+ * Kepler's equation is solved in the universal anomaly s with the Laguerre-Conway iteration, which converges for
+ * elliptic and hyperbolic orbits alike, then the body is moved with the Gauss f and g functions:
+ * r(t) = f * r0 + g * v0, v(t) = f' * r0 + g' * v0
+ */
+void kepler_drift(double mu, double *position, double *velocity, double time) {
+    double r0 = sqrt(position[0] * position[0] + position[1] * position[1] + position[2] * position[2]);
+    if (r0 <= 0 || mu <= 0) {
+        for (int k = 0; k < 3; k++) position[k] += velocity[k] * time;
+        return;
+    }
+    double v2 = velocity[0] * velocity[0] + velocity[1] * velocity[1] + velocity[2] * velocity[2];
+    double eta = position[0] * velocity[0] + position[1] * velocity[1] + position[2] * velocity[2];
+    double beta = 2 * mu / r0 - v2; // positive for bound orbits
+    double zeta = mu - beta * r0;
+    double c[4];
+
+    // A bound orbit comes back to the same point every period, so only the remainder of the time is solved for
+    if (beta > 0) {
+        double period = 2 * M_PI * mu / (beta * sqrt(beta));
+        time = fmod(time, period);
+    }
+    // Start from the universal anomaly of a straight line for short steps, from the mean motion for long ones
+    double s = time / r0;
+    if (beta > 0 && fabs(time) * beta * sqrt(beta) > 0.2 * mu) s = time * beta / mu;
+    double r = r0;
+    for (int iteration = 0; iteration < KEPLER_MAX_ITERATIONS; iteration++) {
+        stumpff(beta * s * s, c);
+        double value = r0 * s * c[1] + eta * s * s * c[2] + mu * s * s * s * c[3] - time;
+        r = r0 * c[0] + eta * s * c[1] + mu * s * s * c[2];
+        double second = eta * c[0] + zeta * s * c[1];
+        double root = sqrt(fabs(16 * r * r - 20 * value * second));
+        double step = 5 * value / (r + (r >= 0 ? root : -root));
+        s -= step;
+        if (fabs(step) <= 1e-15 * fabs(s)) break;
+    }
+    stumpff(beta * s * s, c);
+    r = r0 * c[0] + eta * s * c[1] + mu * s * s * c[2];
+
+    double f = 1 - mu * s * s * c[2] / r0;
+    double g = time - mu * s * s * s * c[3];
+    double f_dot = -mu * s * c[1] / (r * r0);
+    double g_dot = 1 - mu * s * s * c[2] / r;
+    for (int k = 0; k < 3; k++) {
+        double x = position[k], v = velocity[k];
+        position[k] = f * x + g * v;
+        velocity[k] = f_dot * x + g_dot * v;
+    }
+}
+
+/*
+ * Stumpff functions c0 to c3 of z, c_k(z) = sum((-z)^n / (2n + k)!)
+ * Small arguments use the series, which the closed forms would lose to cancellation
+ */
+static void stumpff(double z, double *c) {
+    if (fabs(z) < 0.5) {
+        double term2 = 0.5, term3 = 1.0 / 6;
+        c[2] = 0;
+        c[3] = 0;
+        for (int n = 0; n < 12; n++) {
+            c[2] += term2;
+            c[3] += term3;
+            term2 *= -z / ((2 * n + 3) * (2 * n + 4));
+            term3 *= -z / ((2 * n + 4) * (2 * n + 5));
+        }
+        c[0] = 1 - z * c[2];
+        c[1] = 1 - z * c[3];
+    } else if (z > 0) {
+        double root = sqrt(z);
+        c[0] = cos(root);
+        c[1] = sin(root) / root;
+        c[2] = (1 - c[0]) / z;
+        c[3] = (1 - c[1]) / z;
+    } else {
+        double root = sqrt(-z);
+        c[0] = cosh(root);
+        c[1] = sinh(root) / root;
+        c[2] = (1 - c[0]) / z;
+        c[3] = (1 - c[1]) / z;
+    }
+}
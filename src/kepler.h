@@ -0,0 +1,9 @@
+#ifndef KEPLER_INCLUDE
+#define KEPLER_INCLUDE
+
+// Maximum number of iterations of the solver of Kepler's equation
+#define KEPLER_MAX_ITERATIONS 50
+
+void kepler_drift(double, double *, double *, double);
+
+#endif
@@ -3,19 +3,118 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <unistd.h>
 #include <mpi.h>
+#include <omp.h>
 #include <stdbool.h>
 #include "simulation_configuration.h"
 #include "simulation_support.h"
+#include "gravity_kernel.h"
+#include "barnes_hut.h"
+#include "fast_multipole.h"
+#include "kepler.h"
+#include "spatial_hash.h"
+#include "collision_schedule.h"
+#include "sort_and_sweep.h"
 #include "Task-parallelism/worker.h"
 
+/*
+ * Pairs kept by a thread of check_all_collisions: the collisions it found and the pairs it scheduled
+ */
+struct candidate_lists {
+    int found, capacity, scheduled, scheduled_capacity;
+    long int *pairs, *scheduled_pairs;
+    double *scheduled_times;
+};
+
 // The bodies that are involved in the simulation
-struct body_struct *bodies;
+struct body_store bodies;
 struct body_history *bodies_history;
+// Active bodies packed for the gravity kernel, refreshed at the start of every force computation
+struct gravity_sources sources;
+// Sources of the test particle solver: the sun, planets, moons and asteroids or comets heavy enough to matter
+struct gravity_sources massive;
+int massive_selected_bodies = -1; // number of bodies when the massive sources were last selected
+// Accumulation buffer of the symmetric solver: x, y and z contributions of this process, indexed like the sources
+double *pair_acceleration;
+int pair_start, pair_end; // rows of the triangle of pairs that this process evaluates
+int num_threads; // OpenMP threads of every process, they share the bodies of the process
+long int *collision_pairs; // pairs found by the threads of this process in check_collisions, i * max_body_size + j
+int collision_capacity = 0;
+long int *gathered_collisions; // pairs found by every process, gathered on every process
+int gathered_capacity = 0;
+int *collision_count, *collision_displacement; // number of pairs found by every process and where they start
+int tile_size; // number of sources summed against every target before moving to the next tile, direct summation
+struct barnes_hut_tree tree; // octree of the Barnes-Hut solver, rebuilt by every process at every timestep
+struct barnes_hut_tree fmm_tree; // octree of the fast multipole solver, with larger leaves than the Barnes-Hut one
+struct fast_multipole fmm; // expansions of the fast multipole solver
+struct spatial_hash collision_hash; // grid of the bodies that check_collisions looks for touching pairs in
+struct sort_and_sweep sweep; // bodies sorted along x that check_collisions looks for touching pairs in instead
+double *step_start_x, *step_start_y, *step_start_z; // positions at the start of the timestep, swept collisions
+int step_start_count; // bodies at the start of the timestep, the later ones only have their current position
+double step_start_time; // model time at the start of the timestep
+struct collision_schedule schedule; // candidate pairs of the rows of this process, by the time they could touch
+double schedule_rebuild_time = -1; // model time until which the pairs left out of the schedule can not touch
+double speed_bound, acceleration_bound; // bounds on the speed and acceleration of every body the schedule holds for
+int schedule_start = -1, schedule_end = -1, schedule_bodies = -1, schedule_collisions = -1; // state it was built in
+long int full_collision_checks = 0, scheduled_pair_checks = 0;
+bool record_contacts = false; // whether the direct summation also records the overlapping pairs, fused collisions
+long int *contact_pairs; // pair codes of the overlapping pairs found by the last force computation, i < j
+int contact_count = 0, contact_capacity = 0;
+int contact_bodies = 0; // bodies when the contacts were recorded, the later ones are checked on their own
+// Kick and drift coefficients of the symplectic integrators, a step is kick[0], then drift[k] and kick[k + 1] per stage
+double kick_coefficients[4], drift_coefficients[3];
+int integrator_stages;
+int handled_collisions = 0; // collisions handled so far, every process handles all of them
+bool exchange_velocities; // whether every process needs the velocities of all bodies at every timestep
+MPI_Request position_request = MPI_REQUEST_NULL; // exchange of the positions in flight, overlapped communication
+// Force decomposition: the processes form a grid_size x grid_size grid, process id is in row id / grid_size and column
+// id % grid_size, and the bodies of the processes of a row are the targets of the row and the sources of the column
+int grid_size, grid_row, grid_column;
+MPI_Comm row_comm; // processes of the row of this process, ordered by column
+double *partial_accelerations; // accelerations of the targets of the row from the sources of the column, x, y and z
+int *row_counts, *row_displacements; // 3 * bodies of every process of the row and where they start
+bool *grid_member; // per body, whether it is a body of the row or of the column of this process
+// Shared bodies: the processes of a node share one body store in an MPI-3 shared memory window, the first process of
+// every node is its leader and only the leaders exchange bodies between nodes
+MPI_Comm node_comm, leader_comm; // processes of the node of this process, leaders of every node
+int node_rank, node_count; // rank of this process in its node, number of nodes
+int *node_first; // leaders only, the first process of every node, the last entry is the number of processes
+int *node_body_count, *node_body_displacement; // leaders only, bodies of the processes of every node
+MPI_Win body_window;
+// Load balancing: seconds this process spent on the forces and collision checks of its bodies since the last split
+double balance_time = 0;
+double *balance_times; // seconds of every process, then the cost of one active body of every range
+int *balance_first; // first body of every process in the next split, the last entry is the number of bodies
+int balanced_splits = 0; // splits moved by the load balancing
+long int balance_timestep = 0; // timestep the processes have been timed from
+int new_comets = 0; // comets generated by process 0 in this timestep, not yet sent to the other processes
+// Range of bodies, number of bodies and of handled collisions when this process last computed accelerations, a
+// symplectic step reuses the accelerations of the end of the previous step unless any has changed since, the number of
+// bodies changes for every process at once so they all compute again together
+int accelerations_start = -1, accelerations_end = -1, accelerations_bodies = -1, accelerations_collisions = -1;
+double initial_energy; // total energy of the bodies before the simulation, with ENERGY_REPORT
+// Block timesteps: body i moves with steps of dt / 2^timestep_level[i], -1 until its level has been chosen
+int *timestep_level;
+int *due_bodies; // bodies of this process at the end of their step in the current substep
+double *previous_acceleration; // x, y and z acceleration of the due bodies before their new force computation
+double *range_acceleration; // accelerations of the bodies of this process kept aside while a whole range is computed
+double *kicked_records, *received_records; // index, velocity, acceleration and level of the kicked bodies
+int *record_count, *record_displacement;
+int central_body = -1; // the sun of the Wisdom-Holman integrator, left out of the gravity sources
+long int block_evaluations = 0, block_single_level_evaluations = 0; // force computations, and without block steps
+double *jerk; // x, y and z derivative of the acceleration of every body, Hermite integrator
+double *hermite_start; // position, velocity, acceleration and jerk of the bodies of this process before the step
+double hermite_step_time = 0; // length of the next Hermite step, 0 when it has to be estimated again
+bool output_due = false; // the last Hermite step ended at an output time
+double model_time = 0; // simulated seconds at the end of the last timestep
+long int timesteps_taken = 0, rejected_steps = 0; // rejected steps are Hermite steps taken again with a smaller step
 
 char *filename;
 worker process;
+void *task_args[1] = {&process}; // argument list of the tasks that take the worker
 int file_output_num = 0, history_index = 0;
+int history_size; // number of history entries kept per body before writing to file
 int number_active_bodies = 0, num_asteroids = 0, num_comets = 0; // count number of corresponding bodies
 int stride; // Define how many iterations a process should run
 int max_body_size; // The maximum size of body
@@ -31,7 +130,10 @@ char display_buffer[1000];
 
 struct simulation_configuration_struct configuration;
 
-MPI_Datatype bodies_type; // Self-defined MPI Datatype
+MPI_Datatype body_position_type; // Self-defined MPI Datatype, position of a body
+MPI_Datatype body_dynamic_type; // Self-defined MPI Datatype, position and velocity of a body
+MPI_Datatype body_state_type; // Self-defined MPI Datatype, all double fields of a body but its acceleration
+MPI_Datatype body_metadata_type; // Self-defined MPI Datatype, the cold side table entry of a body
 MPI_Comm comm = MPI_COMM_WORLD;
 MPI_Request request;
 
@@ -45,14 +147,90 @@ static char *parseSecondsToDays(long int, char *);
 
 static void update_thread();
 
+static void balance_ranges();
+
 static void update_locations(double);
 
-static void update_body_acceleration(int);
+static void update_body_acceleration(int, struct gravity_sources *);
+
+static void compute_tiled_accelerations(int, int, int, int, bool);
+
+static void update_body_acceleration_barnes_hut(int);
+
+static void compute_fast_multipole_accelerations();
 
 static void handle_collision(int, int);
 
 static void compute_velocity(double);
 
+static void compute_accelerations();
+
+static void kick(double);
+
+static void drift(double);
+
+static void exchange_positions();
+
+static void exchange_dynamics();
+
+static void compute_overlapped_accelerations();
+
+static void compute_decomposed_accelerations();
+
+static void exchange_grid_positions();
+
+static void gather_output_positions();
+
+static void share_body_store();
+
+static void synchronise_node();
+
+static void exchange_node_blocks(MPI_Datatype);
+
+static int grid_block_first(int);
+
+static bool grid_pair(int, int, int, int);
+
+static void symplectic_step();
+
+static void wisdom_holman_step();
+
+static void block_step();
+
+static void hermite_step();
+
+static void compute_hermite_forces();
+
+static double hermite_initial_step();
+
+static void choose_initial_levels();
+
+static long int next_due_tick(long int);
+
+static void exchange_kicked_bodies(int);
+
+static void compute_due_accelerations(int);
+
+static int timestep_level_for(int, double);
+
+static void select_integrator();
+
+static double total_energy();
+
+static void pack_gravity_sources();
+
+static int pack_gravity_source_range(int, int, int);
+
+static void pack_massive_sources();
+
+static void update_pair_range(int);
+
+static void compute_symmetric_accelerations();
+
+static void report_barnes_hut_accuracy();
+
+static void report_tile_sizes();
+
 static void initialise_bodies();
 
 static void store_history(char *);
@@ -63,46 +241,126 @@ static double getElapsedTime(struct timeval);
 
 static void check_collisions();
 
+static int compare_pair_codes(const void *, const void *);
+
+static bool pair_collides(int, int);
+
+static int resolve_contacts();
+
+static int append_collision(int, long int);
+
+static int check_all_collisions(double, int, int, double, double);
+
+static void check_candidate(int, int, double, struct candidate_lists *);
+
+static void body_bounds(double *, double *);
+
+static bool collision_schedule_expired(double, double, double);
+
+static double step_end_time();
+
 static void end_simulate();
 
 static void comet_invade();
 
 static void gather_broadcast();
 
-static void broadcast();
+static void broadcast_comets();
 
 static void print_frequently();
 
+static void load_timestep();
+
+static void save_step_start();
+
+static void next_timestep();
+
 /*
 * Using the framework, the simulation process can be done in 20 lines of code
+* The queue starts with the first timestep, every timestep loads the next one until the end time is reached
 */
 int main(int argc, char *argv[]) {
-    void **args; // argument list for passing arguments
-    void **empty; // empty argument list
-    args = malloc(sizeof(void *) * 1);
-    args[0] = &process;
-
     initialize_worker(&process, comm, &initialise_function, argc, argv);
 
-    for (int i = 0; i < configuration.num_timesteps; i++) {
-        load_task(&process, &update_thread, args, 1);
-        load_task(&process, &compute_velocity, empty, 0);
-        load_task(&process, &update_locations, empty, 0);
-        load_task(&process, &gather_broadcast, empty, 0);
-        if (process.id == 0) {
-            load_task(&process, &comet_invade, empty, 0);
-        }
-        load_task(&process, &check_collisions, empty, 0);
-        load_task(&process, &broadcast, empty, 0);
-        if (process.id == 0)
-            load_task(&process, &print_frequently, empty, 0);
-    }
-    load_task(&process, &end_simulate, empty, 0);
+    if (configuration.end_time > 0)
+        load_timestep();
+    else
+        load_task(&process, &end_simulate, NULL, 0);
 
     work(&process);
 //    printf("Finish simulation\n");
 }
 
+/*
+* Load the tasks of one timestep, the last of which decides whether another timestep follows
+*/
+static void load_timestep() {
+    load_task(&process, &update_thread, task_args, 1);
+    if (configuration.swept_collisions)
+        load_task(&process, &save_step_start, NULL, 0);
+    if (configuration.integrator == EULER) {
+        load_task(&process, &compute_velocity, NULL, 0);
+        load_task(&process, &update_locations, NULL, 0);
+        load_task(&process, &gather_broadcast, NULL, 0);
+    } else if (configuration.integrator == WISDOM_HOLMAN) {
+        load_task(&process, &wisdom_holman_step, NULL, 0);
+        load_task(&process, &gather_broadcast, NULL, 0);
+    } else if (configuration.integrator == BLOCK) {
+        // Every process already holds every position and velocity at the end of a block step
+        load_task(&process, &block_step, NULL, 0);
+    } else if (configuration.integrator == HERMITE) {
+        load_task(&process, &hermite_step, NULL, 0);
+        load_task(&process, &gather_broadcast, NULL, 0);
+    } else {
+        load_task(&process, &symplectic_step, NULL, 0);
+        // The positions were exchanged after the last drift, overlapped or not, and the last kick only changes the
+        // velocities
+        if (exchange_velocities)
+            load_task(&process, &gather_broadcast, NULL, 0);
+    }
+    if (process.id == 0) {
+        load_task(&process, &comet_invade, NULL, 0);
+    }
+    load_task(&process, &broadcast_comets, NULL, 0);
+    load_task(&process, &check_collisions, NULL, 0);
+    if (configuration.force_decomposition)
+        load_task(&process, &gather_output_positions, NULL, 0);
+    if (process.id == 0)
+        load_task(&process, &print_frequently, NULL, 0);
+    load_task(&process, &next_timestep, NULL, 0);
+}
+
+/*
+* Keep the positions of all bodies at the start of the timestep, every process holds them all after the collisions
+*/
+static void save_step_start() {
+    memcpy(step_start_x, bodies.x, sizeof(double) * number_active_bodies);
+    memcpy(step_start_y, bodies.y, sizeof(double) * number_active_bodies);
+    memcpy(step_start_z, bodies.z, sizeof(double) * number_active_bodies);
+    step_start_count = number_active_bodies;
+    step_start_time = model_time;
+}
+
+/*
+* Count the timestep that just finished, then load the next one or the end of the simulation
+* The Hermite integrator advances the model time itself and stops exactly at the end time, the others stop after the
+* number of timesteps of DT that covers it
+*/
+static void next_timestep() {
+    timesteps_taken++;
+    bool finished;
+    if (configuration.integrator == HERMITE) {
+        finished = model_time >= configuration.end_time;
+    } else {
+        model_time = timesteps_taken * configuration.dt;
+        finished = timesteps_taken >= configuration.num_timesteps;
+    }
+    if (finished)
+        load_task(&process, &end_simulate, NULL, 0);
+    else
+        load_timestep();
+}
+
 /*
  * Update the start and end index for a process
  */
@@ -113,6 +371,11 @@ static void update_thread(worker *man) {
         end = number_active_bodies;
         return;
     }
+    // Once every process has timed its range, the split follows the times
+    if (configuration.load_balance && timesteps_taken > 0) {
+        balance_ranges();
+        return;
+    }
 
     // Update stride, which is the number of iterations that a process should work for
     stride = number_active_bodies / process.population;
@@ -131,6 +394,73 @@ static void update_thread(worker *man) {
     gather_count[process.population - 1] = number_active_bodies - (process.population - 1) * stride;
 }
 
+/*
+* Split the bodies so that every process is expected to take as long as the others, from the time each one spent on
+* its range since the last split
+* The time of a process is spread evenly over the active bodies of its range, inactive bodies cost nothing and the
+* bodies that appeared since the last split cost the average. The time includes the collision checks of the rows that
+* check_collisions pairs with the range, so the triangular rows are weighted too. The processes are timed over
+* LOAD_BALANCE_INTERVAL timesteps, and the split is only moved when the slowest process took LOAD_IMBALANCE_TOLERANCE
+* longer than the average, as the symplectic integrators compute the accelerations again when the range of a process
+* changes
+*/
+static void balance_ranges() {
+    int last = process.population - 1;
+    int split_bodies = gather_displacement[last] + gather_count[last];
+    double total = 0, slowest = 0;
+    if (timesteps_taken - balance_timestep >= LOAD_BALANCE_INTERVAL) {
+        MPI_Allgather(&balance_time, 1, MPI_DOUBLE, balance_times, 1, MPI_DOUBLE, comm);
+        balance_time = 0;
+        balance_timestep = timesteps_taken;
+        for (int p = 0; p < process.population; p++) {
+            total += balance_times[p];
+            slowest = fmax(slowest, balance_times[p]);
+        }
+    }
+    if (slowest <= (1 + LOAD_IMBALANCE_TOLERANCE) * total / process.population) {
+        // The last process takes the bodies that appeared since the last split
+        gather_count[last] = number_active_bodies - gather_displacement[last];
+        if (process.id == last) end = number_active_bodies;
+        return;
+    }
+
+    int active = 0, appeared = 0;
+    for (int p = 0; p < process.population; p++) {
+        int range_active = 0;
+        for (int i = gather_displacement[p]; i < gather_displacement[p] + gather_count[p]; i++)
+            range_active += bodies.active[i];
+        balance_times[p] /= range_active > 0 ? range_active : 1;
+        active += range_active;
+    }
+    for (int i = split_bodies; i < number_active_bodies; i++) appeared += bodies.active[i];
+    double average = active > 0 ? total / active : 0;
+    double share = (total + average * appeared) / process.population, sum = 0;
+
+    // Cut the bodies where the cost summed from the first body reaches a multiple of the share
+    int owner = 0, k = 1;
+    balance_first[0] = 0;
+    for (int i = 0; i < number_active_bodies && k < process.population; i++) {
+        while (owner < last && i >= gather_displacement[owner + 1]) owner++;
+        if (bodies.active[i]) sum += i < split_bodies ? balance_times[owner] : average;
+        while (k < process.population && sum >= k * share) balance_first[k++] = i + 1;
+    }
+    while (k <= process.population) balance_first[k++] = number_active_bodies;
+
+    bool moved = false;
+    for (int p = 1; p < process.population; p++) moved = moved || balance_first[p] != gather_displacement[p];
+    if (moved) {
+        balanced_splits++;
+        // The processes take over bodies whose velocities only their last owners have
+        if (!exchange_velocities) exchange_dynamics();
+    }
+    for (int p = 0; p < process.population; p++) {
+        gather_displacement[p] = balance_first[p];
+        gather_count[p] = balance_first[p + 1] - balance_first[p];
+    }
+    start = balance_first[process.id];
+    end = balance_first[process.id + 1];
+}
+
 
 /*
 * Generate a comet randomly, the comet's name is initialized without sequence number
@@ -139,16 +469,17 @@ static void update_thread(worker *man) {
 */
 static void comet_invade() {
     // Check whether a comet will invade at this timestamp, if it is, initialise it
-    if (random_comet(&bodies[number_active_bodies])) {
-        char buffer[5];
+    if (random_comet(&bodies, number_active_bodies)) {
+        char buffer[12];
         sprintf(buffer, " %d", num_comets++);
-        strcpy(bodies[number_active_bodies].name, "COMET");
-        strcat(bodies[number_active_bodies].name, buffer);
-        tostring(&bodies[number_active_bodies]);
-
-        bodies_history[number_active_bodies].history_x = (double *) calloc(MAX_HISTORY_SIZE, sizeof(double));
-        bodies_history[number_active_bodies].history_y = (double *) calloc(MAX_HISTORY_SIZE, sizeof(double));
-        bodies_history[number_active_bodies++].history_z = (double *) calloc(MAX_HISTORY_SIZE, sizeof(double));
+        strcpy(bodies.metadata[number_active_bodies].name, "COMET");
+        strcat(bodies.metadata[number_active_bodies].name, buffer);
+        tostring(&bodies, number_active_bodies);
+
+        bodies_history[number_active_bodies].history_x = (double *) calloc(history_size, sizeof(double));
+        bodies_history[number_active_bodies].history_y = (double *) calloc(history_size, sizeof(double));
+        bodies_history[number_active_bodies++].history_z = (double *) calloc(history_size, sizeof(double));
+        new_comets++;
     }
 }
 
@@ -156,19 +487,21 @@ static void comet_invade() {
  * Output history data frequently
  */
 static void print_frequently() {
-    if (process.loop_index % configuration.output_frequency == 0) store_history(filename);
+    // Hermite steps are cut short to end at every OUTPUT_FREQUENCY * DT of model time, the other steps are all DT long
+    if (configuration.integrator == HERMITE ? output_due : process.loop_index % configuration.output_frequency == 0)
+        store_history(filename);
     if (process.loop_index > 0 && process.loop_index % configuration.display_progess_frequency == 0) {
+        double time = configuration.integrator == HERMITE ? model_time : process.loop_index * configuration.dt;
         printf("Timestep: %d, model time is %s, current runtime is %.2f seconds, %d bodies studied\n",
-               process.loop_index,
-               parseSecondsToDays((long int) process.loop_index * (long int) configuration.dt, display_buffer),
-               getElapsedTime(start_time), number_active_bodies);
+               process.loop_index, parseSecondsToDays((long int) time, display_buffer), getElapsedTime(start_time),
+               number_active_bodies);
         // Print number of collisions with asteroids and comets for every sun, planet and moon
         for (int j = 0; j < number_active_bodies; j++) {
-            if (bodies[j].type < 3) {
+            if (bodies.type[j] < 3) {
                 printf("For %s, number of collisions with asteroids: %d, with comets: %d\n",
-                       bodies[j].name,
-                       bodies[j].collided_asteroids,
-                       bodies[j].collided_comets);
+                       bodies.metadata[j].name,
+                       bodies.metadata[j].collided_asteroids,
+                       bodies.metadata[j].collided_comets);
             }
         }
     }
@@ -179,62 +512,117 @@ static void print_frequently() {
 * Output statistical data and store history data after simulation
 */
 static void end_simulate() {
+    if (configuration.integrator == BLOCK) {
+        long int counts[2] = {block_evaluations, block_single_level_evaluations};
+        MPI_Reduce(process.id == 0 ? MPI_IN_PLACE : counts, counts, 2, MPI_LONG, MPI_SUM, 0, comm);
+        block_evaluations = counts[0];
+        block_single_level_evaluations = counts[1];
+    }
+    if (configuration.scheduled_collisions) {
+        long int counts[1] = {scheduled_pair_checks};
+        MPI_Reduce(process.id == 0 ? MPI_IN_PLACE : counts, counts, 1, MPI_LONG, MPI_SUM, 0, comm);
+        scheduled_pair_checks = counts[0];
+    }
+    if (configuration.energy_report && !exchange_velocities) exchange_dynamics();
     if (process.id == 0) {
         if (history_index > 0) dump_history_to_file(filename);
         // Reports the total number of collisions
-        printf("Timestep: %d, model time is %s, current runtime is %.2f seconds\n",
-               configuration.num_timesteps,
-               parseSecondsToDays((long int) configuration.num_timesteps * (long int) configuration.dt, display_buffer),
-               getElapsedTime(start_time));
+        printf("Timestep: %ld, model time is %s, current runtime is %.2f seconds\n", timesteps_taken,
+               parseSecondsToDays((long int) model_time, display_buffer), getElapsedTime(start_time));
         for (int j = 0; j < number_active_bodies; j++) {
-            if (bodies[j].type < 3) {
+            if (bodies.type[j] < 3) {
                 printf("For %s, number of collisions with asteroids: %d, with comets: %d\n",
-                       bodies[j].name,
-                       bodies[j].collided_asteroids,
-                       bodies[j].collided_comets);
+                       bodies.metadata[j].name,
+                       bodies.metadata[j].collided_asteroids,
+                       bodies.metadata[j].collided_comets);
                 /*
                  * Sum up the number of collisions
                  */
-                collisions_asteroids += bodies[j].collided_asteroids;
-                collisions_comets += bodies[j].collided_comets;
+                collisions_asteroids += bodies.metadata[j].collided_asteroids;
+                collisions_comets += bodies.metadata[j].collided_comets;
             }
         }
         printf("------------------------------------------------\n");
-        printf("Model completed after %d timesteps\nTotal model time: %s\nTotal runtime: %.2f seconds\n",
-               configuration.num_timesteps,
-               parseSecondsToDays((long int) configuration.num_timesteps * (long int) configuration.dt, display_buffer),
-               getElapsedTime(start_time));
+        printf("Model completed after %ld timesteps\nTotal model time: %s\nTotal runtime: %.2f seconds\n",
+               timesteps_taken, parseSecondsToDays((long int) model_time, display_buffer), getElapsedTime(start_time));
+        printf("Timesteps taken: %ld, rejected: %ld, runtime per simulated year: %.3f seconds\n", timesteps_taken,
+               rejected_steps, model_time > 0 ? getElapsedTime(start_time) / (model_time / 31536000) : 0);
         // Print the statistical results of collisions
         printf("Total sum of collisions with the sun, planets and moons:\n"
                "asteroids: %d\t comets:%d\n", collisions_asteroids, collisions_comets);
+        if (configuration.integrator == BLOCK)
+            printf("Block timesteps: %ld accelerations computed, %ld with every body at the finest level in use\n",
+                   block_evaluations, block_single_level_evaluations);
+        if (configuration.load_balance)
+            printf("Load balancing: the split of the bodies moved %d times\n", balanced_splits);
+        if (configuration.scheduled_collisions)
+            printf("Scheduled collisions: %ld full checks in %ld timesteps, %ld scheduled pair checks\n",
+                   full_collision_checks, timesteps_taken, scheduled_pair_checks);
+        if (configuration.energy_report)
+            printf("Relative energy error: %.3e\n", fabs((total_energy() - initial_energy) / initial_energy));
+    }
+    free(pair_acceleration); // NULL unless the symmetric summation was configured
+    MPI_Type_free(&body_position_type);
+    MPI_Type_free(&body_dynamic_type);
+    MPI_Type_free(&body_state_type);
+    MPI_Type_free(&body_metadata_type);
+    if (configuration.force_decomposition) MPI_Comm_free(&row_comm);
+    if (configuration.shared_bodies && node_rank == 0) MPI_Comm_free(&leader_comm);
+    if (configuration.shared_bodies) {
+        MPI_Win_unlock_all(body_window);
+        MPI_Win_free(&body_window);
+        MPI_Comm_free(&node_comm);
     }
-    MPI_Type_free(&bodies_type);
     MPI_Finalize();
 }
 
 /*
- * Collect data from all processes
- * First, all processes send their local updated data to process 0
- * Then, Process 0 broadcast the updated results to all processes
+ * Give every process the bodies updated by all processes in a single MPI_Allgatherv
+ * The other processes only need the positions for the forces and the collisions, unless the integrator or the
+ * scheduled collisions use the velocities of all bodies. Masses and flags are never sent, as every process applies the
+ * same collisions. With force decomposition, a process only gets the positions of its row and of its column
  */
 static void gather_broadcast() {
-    if (process.id == 0)
-        MPI_Gatherv(MPI_IN_PLACE, end - start, bodies_type, bodies, gather_count, gather_displacement, bodies_type, 0,
-                    comm);
+    if (exchange_velocities)
+        exchange_dynamics();
+    else if (configuration.force_decomposition)
+        exchange_grid_positions();
     else
-        MPI_Gatherv(&bodies[start], end - start, bodies_type, NULL, NULL, NULL, bodies_type, 0, comm);
+        exchange_positions();
+}
 
-    MPI_Bcast(&bodies[0], number_active_bodies, bodies_type, 0, comm);
+/*
+* Give process 0 the positions of all bodies at the timesteps it stores them, with force decomposition the other
+* processes only hold the positions of their row and of their column
+*/
+static void gather_output_positions() {
+    if (process.population <= 1 || timesteps_taken % configuration.output_frequency != 0) return;
+    MPI_Gatherv(process.id == 0 ? MPI_IN_PLACE : &bodies.state[start], end - start, body_position_type, bodies.state,
+                gather_count, gather_displacement, body_position_type, 0, comm);
 }
 
 /*
- * Broadcast synchronized data to all processes
+ * Broadcast the comets generated by process 0 in this timestep, the only bodies that the other processes do not have
+ * Every process then holds the same bodies and applies the same collisions itself, so nothing else is broadcast
  */
-static void broadcast() {
-    // Broadcast the total number of bodies for now to all processes
-    MPI_Bcast(&number_active_bodies, 1, MPI_INT, 0, comm);
-    // Broadcast the updated results to all processes after checking collisions
-    MPI_Bcast(&bodies[0], number_active_bodies, bodies_type, 0, comm);
+static void broadcast_comets() {
+    int range[2] = {number_active_bodies - new_comets, number_active_bodies};
+    MPI_Bcast(range, 2, MPI_INT, 0, comm);
+    new_comets = 0;
+    number_active_bodies = range[1];
+    int count = range[1] - range[0];
+    if (count == 0) return;
+    // The work is split differently from the next timestep, so every process must know the velocities it takes over
+    if (!exchange_velocities) exchange_dynamics();
+    // With shared bodies, only the leaders receive the comets, into the store of their node
+    MPI_Comm bodies_comm = configuration.shared_bodies ? leader_comm : comm;
+    if (bodies_comm != MPI_COMM_NULL) {
+        MPI_Bcast(&bodies.state[range[0]], count, body_state_type, 0, bodies_comm);
+        MPI_Bcast(&bodies.active[range[0]], count, MPI_C_BOOL, 0, bodies_comm);
+        MPI_Bcast(&bodies.type[range[0]], count, MPI_INT, 0, bodies_comm);
+        MPI_Bcast(&bodies.metadata[range[0]], count, body_metadata_type, 0, bodies_comm);
+    }
+    synchronise_node();
 }
 
 /*
@@ -247,70 +635,370 @@ static void check_collisions() {
      * In this way, i and j can be passed at the same time with only one variable
      * To decode, j = pair_code % max_body_size, i = (pair_code - j) / max_body_size
      */
-    int pair_code;
-    int length = 10;
-    int index = 0;
+    /*
+     * Rows of this process, reversed over the bodies the work was split between at the start of the timestep, process 0
+     * also takes the bodies that appeared since then
+     */
+    int split_bodies = process.population > 1 ?
+                       gather_displacement[process.population - 1] + gather_count[process.population - 1] : end;
+    int reverse_start = split_bodies - end;
+    int reverse_end = process.id == 0 ? number_active_bodies : split_bodies - start;
+    int count = 0;
+    double now = step_end_time();
+
+    if (configuration.swept_collisions) {
+        // Bodies that appeared during the timestep did not move
+        for (int i = step_start_count; i < number_active_bodies; i++) {
+            step_start_x[i] = bodies.x[i];
+            step_start_y[i] = bodies.y[i];
+            step_start_z[i] = bodies.z[i];
+        }
+        step_start_count = number_active_bodies;
+    }
 
     /*
-     *  Requests of MPI_Isend for all processes except process 0
-     *  The requests are defined as a dynamic array in case that many collisions are detected by one process
-     *  The size of the request array will be initialised to 10, and it will double every time the array size
-     *  is not enough
+     * With scheduled collisions, only the pairs whose time has come are checked until the schedule expires, a pair
+     * that did not collide is put back with the next time it could touch
+     */
+    double speed = 0, acceleration = 0;
+    if (configuration.scheduled_collisions) body_bounds(&speed, &acceleration);
+    if (configuration.scheduled_collisions && !collision_schedule_expired(now, speed, acceleration)) {
+        while (next_scheduled_time(&schedule) <= now) {
+            long int pair = pop_scheduled_pair(&schedule);
+            int i = (int) (pair / max_body_size);
+            int j = (int) (pair % max_body_size);
+            scheduled_pair_checks++;
+            if (pair_collides(i, j)) {
+                count = append_collision(count, pair);
+            } else {
+                double time = now + earliest_contact_time(&bodies, i, j, acceleration_bound);
+                // A pair that touches while moving apart is checked again at the next timestep
+                if (time <= now) time = nextafter(now, HUGE_VAL);
+                if (time < schedule_rebuild_time) schedule_pair(&schedule, time, pair);
+            }
+        }
+    } else if (configuration.fused_collisions) {
+        count = resolve_contacts();
+    } else {
+        struct timeval timer;
+        gettimeofday(&timer, NULL);
+        count = check_all_collisions(now, reverse_start, reverse_end, speed, acceleration);
+        balance_time += getElapsedTime(timer);
+    }
+    /*
+     * Every process gets the pairs found by all processes in a single gather and sorts them, so that every process
+     * handles the same collisions in the same order as with a single process and thread, and ends up with the same
+     * bodies without any broadcast
      */
-    MPI_Request *requests_collision;
-    requests_collision = (MPI_Request *) malloc(sizeof(MPI_Request) * length);
+    MPI_Allgather(&count, 1, MPI_INT, collision_count, 1, MPI_INT, comm);
+    int total = 0;
+    for (int k = 0; k < process.population; k++) {
+        collision_displacement[k] = total;
+        total += collision_count[k];
+    }
+    if (total > gathered_capacity) {
+        gathered_capacity = total * 2;
+        gathered_collisions = (long int *) realloc(gathered_collisions, sizeof(long int) * gathered_capacity);
+    }
+    MPI_Allgatherv(collision_pairs, count, MPI_LONG, gathered_collisions, collision_count, collision_displacement,
+                   MPI_LONG, comm);
+    // The collisions change the velocities of the bodies from those of the other bodies
+    if (total > 0 && !exchange_velocities) exchange_dynamics();
+    qsort(gathered_collisions, total, sizeof(long int), &compare_pair_codes);
+    // With shared bodies, the leader of every node handles the collisions in the store of the node
+    if (!configuration.shared_bodies || node_rank == 0) {
+        for (int k = 0; k < total; k++) {
+            int i = (int) (gathered_collisions[k] / max_body_size);
+            int j = (int) (gathered_collisions[k] % max_body_size);
+            // A body may have been removed by a collision handled earlier in this timestep
+            if (bodies.active[i] && bodies.active[j]) handle_collision(i, j);
+        }
+    }
+    if (configuration.shared_bodies && total > 0) {
+        synchronise_node();
+        int counts[3] = {number_active_bodies, handled_collisions, num_asteroids};
+        MPI_Bcast(counts, 3, MPI_INT, 0, node_comm);
+        number_active_bodies = counts[0];
+        handled_collisions = counts[1];
+        num_asteroids = counts[2];
+    }
+}
 
-    int reverse_start = number_active_bodies - end;
-    int reverse_end = number_active_bodies - start;
+/*
+* Checks every pair of the rows of this process that is close enough to collide, stores the collisions found in
+* collision_pairs and returns their number
+* With the spatial hash, every process puts all the bodies into cells as wide as twice the largest radius, so a body
+* can only touch the bodies of the 27 cells around its own, instead of every other body
+* With sort and sweep, every process keeps all the bodies sorted along x, so a body can only touch the following
+* bodies until the first one whose interval starts after its own ends
+* With swept collisions, the cells or the intervals also cover the displacement over the timestep, so that bodies that
+* touched at any time of the timestep are still candidates at its end
+* With scheduled collisions, the cells or the intervals are also wider by the distance that two bodies can close in
+* until the next full check, and the pairs that did not collide are scheduled for the time they could touch
+* With force decomposition, a process only holds the positions of the bodies of its row and of its column, so it puts
+* those into the hash or the order and checks the pairs between them. Every pair of blocks of the grid is checked by
+* one of the two processes that hold both, the one above the diagonal when the sum of the blocks is even and the one
+* below otherwise, and a process on the diagonal checks the pairs within its block. When bodies appeared in this
+* timestep every process has received all the positions, and the rows are checked as without force decomposition
+*/
+static int check_all_collisions(double now, int reverse_start, int reverse_end, double speed, double acceleration) {
+    int count = 0;
+    double margin = 0;
+    if (configuration.scheduled_collisions) {
+        // Leave room for the speeds and accelerations to double before the schedule has to be built again
+        clear_collision_schedule(&schedule);
+        speed_bound = 2 * speed;
+        acceleration_bound = 2 * acceleration;
+        schedule_rebuild_time = now + configuration.collision_schedule_steps * configuration.dt;
+        margin = 2 * speed_bound * (schedule_rebuild_time - now);
+        schedule_start = start;
+        schedule_end = end;
+        schedule_bodies = number_active_bodies;
+        schedule_collisions = handled_collisions;
+        full_collision_checks++;
+    }
+    bool grid = configuration.force_decomposition && number_active_bodies == grid_block_first(grid_size);
+    int row_first = 0, row_last = 0, column_first = 0, column_last = 0;
+    if (grid) {
+        if (grid_row != grid_column && (grid_row < grid_column) != ((grid_row + grid_column) % 2 == 0)) return 0;
+        row_first = grid_block_first(grid_row);
+        row_last = grid_block_first(grid_row + 1);
+        column_first = grid_block_first(grid_column);
+        column_last = grid_block_first(grid_column + 1);
+        memset(grid_member, 0, sizeof(bool) * number_active_bodies);
+        for (int i = row_first; i < row_last; i++) grid_member[i] = true;
+        for (int i = column_first; i < column_last; i++) grid_member[i] = true;
+    }
+    double largest_radius = 0, largest_displacement = 0;
+    if (configuration.broad_phase == SPATIAL_HASH) {
+        for (int i = 0; i < number_active_bodies; i++) {
+            if (!bodies.active[i]) continue;
+            if (bodies.radius[i] > largest_radius) largest_radius = bodies.radius[i];
+            if (configuration.swept_collisions) {
+                double dx = bodies.x[i] - step_start_x[i];
+                double dy = bodies.y[i] - step_start_y[i];
+                double dz = bodies.z[i] - step_start_z[i];
+                largest_displacement = fmax(largest_displacement, sqrt(dx * dx + dy * dy + dz * dz));
+            }
+        }
+    }
+    // Two bodies that touched at any time of the timestep are at most this far apart at its end
+    double reach = 2 * (largest_radius + largest_displacement);
+    bool *members = grid ? grid_member : NULL;
+    if (configuration.broad_phase == SORT_AND_SWEEP) {
+        update_sort_and_sweep(&sweep, &bodies, number_active_bodies,
+                              configuration.swept_collisions ? step_start_x : NULL, margin / 2, members);
+    } else {
+        double cell_size = reach + margin;
+        build_spatial_hash(&collision_hash, &bodies, number_active_bodies, cell_size > 0 ? cell_size : 1, members);
+    }
 
-    for (int i = reverse_start; i < reverse_end; i++) {
-        // Now check for bodies i+1, so don't check own body but all beyond it in the bodies array
-        // Don't check any earlier as we have symmetry here so would mean duplicate checks and updates
-        for (int j = i + 1; j < number_active_bodies; j++) {
-            if (bodies[i].active && bodies[j].active && !((bodies[i].type == MOON && bodies[j].type == PLANET) ||
-                                                          (bodies[j].type == MOON && bodies[i].type == PLANET))) {
-                if (checkForCollision(&bodies[i], &bodies[j])) {
-                    if (process.id == 0) {
-                        handle_collision(i, j);
-                    } else {
-                        if (index == length) {
-                            length *= 2;
-                            requests_collision = (MPI_Request *) realloc(requests_collision,
-                                                                         sizeof(MPI_Request) * length);
-                        }
-                        pair_code = i * max_body_size + j;
-                        MPI_Isend(&pair_code, 1, MPI_INT, 0, process.id, comm, &requests_collision[index++]);
+    /*
+     * The threads of the process share the pairs to check, each keeps the collisions it finds and the pairs it
+     * schedules in its own lists and appends them at the end
+     */
+#pragma omp parallel
+    {
+        struct candidate_lists lists = {.found = 0, .capacity = 16, .scheduled = 0, .scheduled_capacity = 16,
+                                        .pairs = NULL, .scheduled_pairs = NULL, .scheduled_times = NULL};
+        lists.pairs = (long int *) malloc(sizeof(long int) * lists.capacity);
+        lists.scheduled_pairs = (long int *) malloc(sizeof(long int) * lists.scheduled_capacity);
+        lists.scheduled_times = (double *) malloc(sizeof(double) * lists.scheduled_capacity);
+        if (configuration.broad_phase == SORT_AND_SWEEP) {
+#pragma omp for schedule(dynamic, 64) nowait
+            for (int k = 0; k < sweep.count; k++) {
+                for (int m = k + 1; m < sweep.count && sweep.low[m] <= sweep.high[k]; m++) {
+                    int i = sweep.order[k] < sweep.order[m] ? sweep.order[k] : sweep.order[m];
+                    int j = sweep.order[k] < sweep.order[m] ? sweep.order[m] : sweep.order[k];
+                    // A pair is checked by the process that has the row of its first body, or both of its blocks of
+                    // the grid
+                    if (grid ? grid_pair(i, j, row_first, row_last) : i >= reverse_start && i < reverse_end)
+                        check_candidate(i, j, now, &lists);
+                }
+            }
+        } else {
+            // Off the diagonal of the grid, the rows are the bodies of the row and then those of the column
+            int grid_rows = row_last - row_first + (grid_row != grid_column ? column_last - column_first : 0);
+            int rows = grid ? grid_rows : reverse_end - reverse_start;
+#pragma omp for schedule(dynamic, 16) nowait
+            for (int row = 0; row < rows; row++) {
+                int i = !grid ? reverse_start + row :
+                        row < row_last - row_first ? row_first + row : column_first + row - (row_last - row_first);
+                if (!bodies.active[i]) continue;
+                for (int neighbour = 0; neighbour < 27; neighbour++) {
+                    long int cell_x = collision_hash.cell_x[i] + neighbour % 3 - 1;
+                    long int cell_y = collision_hash.cell_y[i] + neighbour / 3 % 3 - 1;
+                    long int cell_z = collision_hash.cell_z[i] + neighbour / 9 - 1;
+                    int bucket = spatial_hash_bucket(&collision_hash, cell_x, cell_y, cell_z);
+                    for (int k = collision_hash.bucket_start[bucket]; k < collision_hash.bucket_start[bucket + 1];
+                         k++) {
+                        int j = collision_hash.bodies[k];
+                        // Only check the bodies after i, the ones before check i themselves, and skip the other
+                        // cells that share the bucket
+                        if (j <= i || collision_hash.cell_x[j] != cell_x || collision_hash.cell_y[j] != cell_y ||
+                            collision_hash.cell_z[j] != cell_z)
+                            continue;
+                        if (grid && !grid_pair(i, j, row_first, row_last)) continue;
+                        check_candidate(i, j, now, &lists);
                     }
                 }
             }
         }
+#pragma omp critical
+        {
+            if (count + lists.found > collision_capacity) {
+                collision_capacity = (count + lists.found) * 2;
+                collision_pairs = (long int *) realloc(collision_pairs, sizeof(long int) * collision_capacity);
+            }
+            memcpy(&collision_pairs[count], lists.pairs, sizeof(long int) * lists.found);
+            count += lists.found;
+            for (int k = 0; k < lists.scheduled; k++)
+                schedule_pair(&schedule, lists.scheduled_times[k], lists.scheduled_pairs[k]);
+        }
+        free(lists.pairs);
+        free(lists.scheduled_pairs);
+        free(lists.scheduled_times);
     }
+    return count;
+}
 
-    if (process.id == 0) {
-        int temp_pair_code;
-        MPI_Status status;
+/*
+* Whether this process checks the pair of bodies i and j of its row and of its column, with force decomposition
+* On the diagonal of the grid the row is the column and every pair is checked, off it only the pairs between the two
+*/
+static bool grid_pair(int i, int j, int row_first, int row_last) {
+    return grid_row == grid_column || (i >= row_first && i < row_last) != (j >= row_first && j < row_last);
+}
 
-        /*
-         * This loop handles messages from other processes consequently
-         * Every time it receives an end message (a message with tag 0), the i increases 1
-         * It ends if messages from all processes are handled
-         * If the message tag is not 0, then it decodes the message and handle the collision
-         */
-        for (int i = 1; i < process.population;) {
-            MPI_Recv(&temp_pair_code, 1, MPI_INT, MPI_ANY_SOURCE, MPI_ANY_TAG, comm, &status);
-            if (status.MPI_TAG == 0)
-                i++;
-            else {
-                int temp = temp_pair_code % max_body_size;
-                handle_collision((temp_pair_code - temp) / max_body_size, temp);
-            }
+/*
+* Checks a candidate pair i < j of check_all_collisions, adding it to the collisions of the thread if it collides,
+* or to the pairs the thread schedules if it could touch before the next full check
+*/
+static void check_candidate(int i, int j, double now, struct candidate_lists *lists) {
+    if ((bodies.type[i] == MOON && bodies.type[j] == PLANET) || (bodies.type[j] == MOON && bodies.type[i] == PLANET))
+        return;
+    if (pair_collides(i, j)) {
+        if (lists->found == lists->capacity) {
+            lists->capacity *= 2;
+            lists->pairs = (long int *) realloc(lists->pairs, sizeof(long int) * lists->capacity);
+        }
+        lists->pairs[lists->found++] = (long int) i * max_body_size + j;
+    } else if (configuration.scheduled_collisions) {
+        double time = now + earliest_contact_time(&bodies, i, j, acceleration_bound);
+        if (time >= schedule_rebuild_time) return;
+        if (lists->scheduled == lists->scheduled_capacity) {
+            lists->scheduled_capacity *= 2;
+            lists->scheduled_pairs = (long int *) realloc(lists->scheduled_pairs,
+                                                          sizeof(long int) * lists->scheduled_capacity);
+            lists->scheduled_times = (double *) realloc(lists->scheduled_times,
+                                                        sizeof(double) * lists->scheduled_capacity);
+        }
+        lists->scheduled_pairs[lists->scheduled] = (long int) i * max_body_size + j;
+        lists->scheduled_times[lists->scheduled++] = time;
+    }
+}
+
+/*
+* Stores the collisions among the pairs that the last force computation found overlapping in collision_pairs and
+* returns their number, the force computation was at the positions of the end of the timestep
+* Process 0 checks the bodies that appeared since then, such as a new comet, against every other body
+*/
+static int resolve_contacts() {
+    int count = 0;
+    for (int k = 0; k < contact_count; k++) {
+        int i = (int) (contact_pairs[k] / max_body_size);
+        int j = (int) (contact_pairs[k] % max_body_size);
+        if ((bodies.type[i] == MOON && bodies.type[j] == PLANET) || (bodies.type[j] == MOON && bodies.type[i] == PLANET))
+            continue;
+        if (checkForCollision(&bodies, i, j)) count = append_collision(count, contact_pairs[k]);
+    }
+    for (int j = process.id == 0 ? contact_bodies : number_active_bodies; j < number_active_bodies; j++) {
+        for (int i = 0; i < j; i++) {
+            if (!bodies.active[i] || !bodies.active[j]) continue;
+            if ((bodies.type[i] == MOON && bodies.type[j] == PLANET) ||
+                (bodies.type[j] == MOON && bodies.type[i] == PLANET))
+                continue;
+            if (checkForCollision(&bodies, i, j)) count = append_collision(count, (long int) i * max_body_size + j);
         }
-    } else {
-        // Complete non-blocking sends
-        MPI_Waitall(index, requests_collision, MPI_STATUS_IGNORE);
-        // Complete sending collision report
-        MPI_Ssend(&index, 1, MPI_INT, 0, 0, comm);
     }
+    return count;
+}
+
+/*
+* Append a pair code to the count collisions in collision_pairs, growing it when it is full
+*/
+static int append_collision(int count, long int pair) {
+    if (count == collision_capacity) {
+        collision_capacity = collision_capacity > 0 ? collision_capacity * 2 : 16;
+        collision_pairs = (long int *) realloc(collision_pairs, sizeof(long int) * collision_capacity);
+    }
+    collision_pairs[count] = pair;
+    return count + 1;
+}
+
+/*
+* Whether two bodies collide in this timestep, at its end or along their paths over it with swept collisions
+*/
+static bool pair_collides(int i, int j) {
+    if (configuration.swept_collisions)
+        return checkForSweptCollision(&bodies, step_start_x, step_start_y, step_start_z, i, j) >= 0;
+    return checkForCollision(&bodies, i, j);
+}
+
+/*
+* Largest speed and acceleration of the active bodies, the accelerations being reduced over every process as each
+* only has those of its own bodies
+* The Wisdom-Holman integrator leaves the pull of the sun out of the accelerations, so it is added back
+*/
+static void body_bounds(double *speed, double *acceleration) {
+    double largest_speed = 0, bound[1] = {0};
+    for (int i = 0; i < number_active_bodies; i++) {
+        if (!bodies.active[i]) continue;
+        largest_speed = fmax(largest_speed, sqrt(bodies.velocity_x[i] * bodies.velocity_x[i] +
+                                                 bodies.velocity_y[i] * bodies.velocity_y[i] +
+                                                 bodies.velocity_z[i] * bodies.velocity_z[i]));
+    }
+    for (int i = start; i < end; i++) {
+        if (!bodies.active[i]) continue;
+        double body_acceleration = sqrt(bodies.acceleration_x[i] * bodies.acceleration_x[i] +
+                                        bodies.acceleration_y[i] * bodies.acceleration_y[i] +
+                                        bodies.acceleration_z[i] * bodies.acceleration_z[i]);
+        if (central_body >= 0 && i != central_body) {
+            double dx = bodies.x[central_body] - bodies.x[i];
+            double dy = bodies.y[central_body] - bodies.y[i];
+            double dz = bodies.z[central_body] - bodies.z[i];
+            body_acceleration += G_CONSTANT * bodies.mass[central_body] / (dx * dx + dy * dy + dz * dz);
+        }
+        bound[0] = fmax(bound[0], body_acceleration);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, bound, 1, MPI_DOUBLE, MPI_MAX, comm);
+    *speed = largest_speed;
+    *acceleration = bound[0];
+}
+
+/*
+* Whether the collision schedule has to be built again: when its time is up, when bodies appeared, collided or moved
+* between processes, or when a body got faster or accelerates more than the schedule allowed for
+*/
+static bool collision_schedule_expired(double now, double speed, double acceleration) {
+    return now >= schedule_rebuild_time || start != schedule_start || end != schedule_end ||
+           number_active_bodies != schedule_bodies || handled_collisions != schedule_collisions ||
+           speed > speed_bound || acceleration > acceleration_bound;
+}
+
+/*
+* Model time at the end of the current timestep, the fixed timestep integrators count it in next_timestep
+*/
+static double step_end_time() {
+    return configuration.integrator == HERMITE ? model_time : (timesteps_taken + 1) * configuration.dt;
+}
+
+/*
+ * Orders pair codes increasingly, i.e. by the first body and then by the second one
+ */
+static int compare_pair_codes(const void *a, const void *b) {
+    long int first = *(const long int *) a, second = *(const long int *) b;
+    return (first > second) - (first < second);
 }
 
 /*
@@ -319,40 +1007,55 @@ static void check_collisions() {
  * collided asteroids will split into four asteroids.
  */
 static void handle_collision(int i, int j) {
-    printf("Collision between %s and %s, their state: %d and %d\n", bodies[i].name, bodies[j].name,
-           bodies[i].active, bodies[j].active);
-    if (bodies[i].type == ASTEROID && bodies[j].type == ASTEROID) {
+    handled_collisions++;
+    // Every process handles the collision, only process 0 reports it
+    if (process.id == 0 && configuration.swept_collisions) {
+        // Every process has the same positions, so the time of the first contact is found again here
+        double step_length = step_end_time() - step_start_time;
+        double contact = checkForSweptCollision(&bodies, step_start_x, step_start_y, step_start_z, i, j);
+        printf("Collision between %s and %s, their state: %d and %d, first contact %.1f seconds into the timestep\n",
+               bodies.metadata[i].name, bodies.metadata[j].name, bodies.active[i], bodies.active[j],
+               contact * step_length);
+    } else if (process.id == 0) {
+        printf("Collision between %s and %s, their state: %d and %d\n", bodies.metadata[i].name,
+               bodies.metadata[j].name, bodies.active[i], bodies.active[j]);
+    }
+    if (bodies.type[i] == ASTEROID && bodies.type[j] == ASTEROID) {
         /*
          * Check if the two asteroids shall split into four asteroids
          * Collision behaviour is encapsulated in the function handle_asteroid_asteroid_bodies()
          */
-        if (handle_asteroid_asteroid_collision(&bodies[i], &bodies[j])) {
-            char buffer[5];
+        // One in ten collisions split, drawn from the pair and the timestep so that every process draws the same
+        bool split = counter_random((uint64_t) i * max_body_size + j, (uint64_t) timesteps_taken) % 10 == 0;
+        if (handle_asteroid_asteroid_collision(&bodies, i, j, split)) {
+            char buffer[12];
             for (int k = number_active_bodies; k < 4 + number_active_bodies; k++) {
                 sprintf(buffer, "%d", num_asteroids++);
-                strcpy(bodies[k].name, "ASTEROIDS");
-                strcat(bodies[k].name, buffer);
-                bodies_history[k].history_x = (double *) calloc(MAX_HISTORY_SIZE, sizeof(double));
-                bodies_history[k].history_y = (double *) calloc(MAX_HISTORY_SIZE, sizeof(double));
-                bodies_history[k].history_z = (double *) calloc(MAX_HISTORY_SIZE, sizeof(double));
+                strcpy(bodies.metadata[k].name, "ASTEROIDS");
+                strcat(bodies.metadata[k].name, buffer);
+                // Only process 0 stores the history
+                if (process.id != 0) continue;
+                bodies_history[k].history_x = (double *) calloc(history_size, sizeof(double));
+                bodies_history[k].history_y = (double *) calloc(history_size, sizeof(double));
+                bodies_history[k].history_z = (double *) calloc(history_size, sizeof(double));
             }
-            split_asteroid(&bodies[i], &bodies[number_active_bodies++], true);
-            split_asteroid(&bodies[i], &bodies[number_active_bodies++], false);
-            split_asteroid(&bodies[j], &bodies[number_active_bodies++], true);
-            split_asteroid(&bodies[j], &bodies[number_active_bodies++], false);
+            split_asteroid(&bodies, i, number_active_bodies++, true);
+            split_asteroid(&bodies, i, number_active_bodies++, false);
+            split_asteroid(&bodies, j, number_active_bodies++, true);
+            split_asteroid(&bodies, j, number_active_bodies++, false);
         }
-    } else if ((bodies[i].type == ASTEROID || bodies[i].type == COMET) &&
-               (bodies[j].type == PLANET || bodies[j].type == SUN || bodies[j].type == MOON)) {
-        handle_planet_asteroid_collision(&bodies[j], &bodies[i]);
-    } else if ((bodies[i].type == PLANET || bodies[i].type == SUN || bodies[i].type == MOON) &&
-               (bodies[j].type == ASTEROID || bodies[i].type == COMET)) {
-        handle_planet_asteroid_collision(&bodies[i], &bodies[j]);
-    } else if (bodies[i].type == COMET && bodies[j].type == COMET) {
-        handle_comet_comet_collision(&bodies[i], &bodies[j]);
-    } else if (bodies[i].type == ASTEROID && bodies[j].type == COMET) {
-        handle_asteroid_comet_collision(&bodies[i], &bodies[j]);
-    } else if (bodies[i].type == COMET && bodies[j].type == ASTEROID) {
-        handle_asteroid_comet_collision(&bodies[j], &bodies[i]);
+    } else if ((bodies.type[i] == ASTEROID || bodies.type[i] == COMET) &&
+               (bodies.type[j] == PLANET || bodies.type[j] == SUN || bodies.type[j] == MOON)) {
+        handle_planet_asteroid_collision(&bodies, j, i);
+    } else if ((bodies.type[i] == PLANET || bodies.type[i] == SUN || bodies.type[i] == MOON) &&
+               (bodies.type[j] == ASTEROID || bodies.type[j] == COMET)) {
+        handle_planet_asteroid_collision(&bodies, i, j);
+    } else if (bodies.type[i] == COMET && bodies.type[j] == COMET) {
+        handle_comet_comet_collision(&bodies, i, j);
+    } else if (bodies.type[i] == ASTEROID && bodies.type[j] == COMET) {
+        handle_asteroid_comet_collision(&bodies, i, j);
+    } else if (bodies.type[i] == COMET && bodies.type[j] == ASTEROID) {
+        handle_asteroid_comet_collision(&bodies, j, i);
     }
 }
 
@@ -360,42 +1063,1187 @@ static void handle_collision(int i, int j) {
 * Computes the velocity of all bodies in the simulation based upon their gravitational interactions with all other bodies
 */
 static void compute_velocity() {
-    for (int i = start; i < end; i++) {
-        if (bodies[i].active) {
-            update_body_acceleration(i);
-            bodies[i].velocity_x += bodies[i].acceleration_x * configuration.dt;
-            bodies[i].velocity_y += bodies[i].acceleration_y * configuration.dt;
-            bodies[i].velocity_z += bodies[i].acceleration_z * configuration.dt;
+    compute_accelerations();
+    kick(configuration.dt);
+}
+
+/*
+* Computes the acceleration of the bodies of this process from the current positions of all bodies, with the solver
+* of the configuration
+*/
+static void compute_accelerations() {
+    struct timeval timer;
+    gettimeofday(&timer, NULL);
+    if (configuration.gravity_solver == TEST_PARTICLES)
+        pack_massive_sources();
+    else if (!configuration.force_decomposition)
+        pack_gravity_sources();
+    if (configuration.gravity_solver == SYMMETRIC_SUMMATION)
+        compute_symmetric_accelerations();
+    else if (configuration.gravity_solver == BARNES_HUT)
+        build_barnes_hut_tree(&tree, &sources);
+    else if (configuration.gravity_solver == FAST_MULTIPOLE)
+        compute_fast_multipole_accelerations();
+    else if (configuration.force_decomposition)
+        compute_decomposed_accelerations();
+    else if (configuration.gravity_solver == DIRECT_SUMMATION)
+        compute_tiled_accelerations(start, end, tile_size, 0, true);
+    if (configuration.gravity_solver == TEST_PARTICLES || configuration.gravity_solver == BARNES_HUT) {
+#pragma omp parallel for schedule(dynamic, 64)
+        for (int i = start; i < end; i++) {
+            if (bodies.active[i]) {
+                if (configuration.gravity_solver == TEST_PARTICLES)
+                    update_body_acceleration(i, &massive);
+                else
+                    update_body_acceleration_barnes_hut(i);
+            }
         }
     }
+    accelerations_start = start;
+    accelerations_end = end;
+    accelerations_bodies = number_active_bodies;
+    accelerations_collisions = handled_collisions;
+    balance_time += getElapsedTime(timer);
 }
 
 /*
 * Based on the velocity of each body will update its location
 */
 static void update_locations() {
+    drift(configuration.dt);
+}
+
+/*
+* Update the velocity of the bodies of this process with their acceleration over the given time
+*/
+static void kick(double time) {
+#pragma omp parallel for schedule(static)
+    for (int i = start; i < end; i++) {
+        if (bodies.active[i]) {
+            bodies.velocity_x[i] += bodies.acceleration_x[i] * time;
+            bodies.velocity_y[i] += bodies.acceleration_y[i] * time;
+            bodies.velocity_z[i] += bodies.acceleration_z[i] * time;
+        }
+    }
+}
+
+/*
+* Update the location of the bodies of this process with their velocity over the given time
+*/
+static void drift(double time) {
+    // The other processes of the node may still be reading the positions for their forces
+    synchronise_node();
+#pragma omp parallel for schedule(static)
+    for (int i = start; i < end; i++) {
+        if (bodies.active[i]) {
+            bodies.x[i] += bodies.velocity_x[i] * time;
+            bodies.y[i] += bodies.velocity_y[i] * time;
+            bodies.z[i] += bodies.velocity_z[i] * time;
+        }
+    }
+}
+
+/*
+* Give every process the positions of all bodies after a drift, so that the next accelerations can be computed
+*/
+static void exchange_positions() {
+    if (process.population <= 1) return;
+    if (configuration.shared_bodies) {
+        exchange_node_blocks(body_position_type);
+        return;
+    }
+    MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, bodies.state, gather_count, gather_displacement,
+                   body_position_type, comm);
+}
+
+/*
+* Computes the acceleration of the bodies of this process with direct summation while the positions are exchanged
+* The bodies of this process are packed first and the exchange is started, they are summed against each other while
+* the positions of the other bodies are in flight, then the other bodies are packed and added once they have arrived
+* The sources are summed in a different order than with compute_accelerations, so the accelerations differ by rounding
+*/
+static void compute_overlapped_accelerations() {
+    struct timeval timer;
+    gettimeofday(&timer, NULL);
+    sources.count = pack_gravity_source_range(start, end, 0);
+    int local_sources = sources.count;
+    if (process.population > 1)
+        MPI_Iallgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, bodies.state, gather_count, gather_displacement,
+                        body_position_type, comm, &position_request);
+    compute_tiled_accelerations(start, end, tile_size, 0, false);
+    MPI_Wait(&position_request, MPI_STATUS_IGNORE);
+    sources.count = pack_gravity_source_range(0, start, sources.count);
+    sources.count = pack_gravity_source_range(end, number_active_bodies, sources.count);
+    compute_tiled_accelerations(start, end, tile_size, local_sources, true);
+    accelerations_start = start;
+    accelerations_end = end;
+    accelerations_bodies = number_active_bodies;
+    accelerations_collisions = handled_collisions;
+    balance_time += getElapsedTime(timer);
+}
+
+/*
+* Computes the acceleration of the bodies of this process with direct summation split over the grid of processes
+* Every process sums the forces of the sources of its column on the targets of its row, and the partial accelerations
+* are summed over the row by MPI_Reduce_scatter, which leaves every process with the accelerations of its own bodies
+* A process only needs the positions of the bodies of its row and of its column, 2N / grid_size instead of N
+*/
+static void compute_decomposed_accelerations() {
+    int row_first = grid_block_first(grid_row), row_last = grid_block_first(grid_row + 1);
+    int column_first = grid_block_first(grid_column), column_last = grid_block_first(grid_column + 1);
+    sources.count = pack_gravity_source_range(column_first, column_last, 0);
+    compute_tiled_accelerations(row_first, row_last, tile_size, 0, true);
+    if (grid_size == 1) return;
+#pragma omp parallel for schedule(static)
+    for (int i = row_first; i < row_last; i++) {
+        partial_accelerations[3 * (i - row_first)] = bodies.acceleration_x[i];
+        partial_accelerations[3 * (i - row_first) + 1] = bodies.acceleration_y[i];
+        partial_accelerations[3 * (i - row_first) + 2] = bodies.acceleration_z[i];
+    }
+    for (int k = 0; k < grid_size; k++) row_counts[k] = 3 * gather_count[grid_row * grid_size + k];
+    MPI_Reduce_scatter(MPI_IN_PLACE, partial_accelerations, row_counts, MPI_DOUBLE, MPI_SUM, row_comm);
+    // The sums for the bodies of this process are now at the start of the buffer
+#pragma omp parallel for schedule(static)
+    for (int i = start; i < end; i++) {
+        bodies.acceleration_x[i] = partial_accelerations[3 * (i - start)];
+        bodies.acceleration_y[i] = partial_accelerations[3 * (i - start) + 1];
+        bodies.acceleration_z[i] = partial_accelerations[3 * (i - start) + 2];
+    }
+}
+
+/*
+* Give every process the positions of the bodies of its row and of its column after a drift
+* The processes of a row gather the bodies of the row, then every process swaps its row with the process across the
+* diagonal of the grid, whose row is the column of this process
+*/
+static void exchange_grid_positions() {
+    if (grid_size == 1) return;
+    for (int k = 0; k < grid_size; k++) {
+        row_counts[k] = gather_count[grid_row * grid_size + k];
+        row_displacements[k] = gather_displacement[grid_row * grid_size + k];
+    }
+    MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, bodies.state, row_counts, row_displacements,
+                   body_position_type, row_comm);
+    if (grid_row == grid_column) return;
+    int row_first = grid_block_first(grid_row), column_first = grid_block_first(grid_column);
+    int across = grid_column * grid_size + grid_row;
+    MPI_Sendrecv(&bodies.state[row_first], grid_block_first(grid_row + 1) - row_first, body_position_type, across,
+                 0, &bodies.state[column_first], grid_block_first(grid_column + 1) - column_first,
+                 body_position_type, across, 0, comm, MPI_STATUS_IGNORE);
+}
+
+/*
+* First body of a block of rows or columns of the grid, a block holds the bodies of grid_size processes
+*/
+static int grid_block_first(int block) {
+    // A single process does not fill in the counts and displacements
+    if (process.population == 1) return block == 0 ? 0 : end;
+    if (block == grid_size) return gather_displacement[process.population - 1] + gather_count[process.population - 1];
+    return gather_displacement[block * grid_size];
+}
+
+/*
+* Give every process the positions and velocities of all bodies
+*/
+static void exchange_dynamics() {
+    if (process.population <= 1) return;
+    if (configuration.shared_bodies) {
+        exchange_node_blocks(body_dynamic_type);
+        return;
+    }
+    MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, bodies.state, gather_count, gather_displacement,
+                   body_dynamic_type, comm);
+}
+
+/*
+* Place the body store in a window shared by the processes of the node, the leader of the node allocates all of it
+*/
+static void share_body_store() {
+    void *block;
+    MPI_Aint size;
+    int unit;
+    MPI_Win_allocate_shared(node_rank == 0 ? (MPI_Aint) body_store_size(max_body_size) : 0, 1, MPI_INFO_NULL,
+                            node_comm, &block, &body_window);
+    MPI_Win_shared_query(body_window, 0, &size, &unit, &block);
+    if (node_rank == 0) memset(block, 0, body_store_size(max_body_size));
+    place_body_store(&bodies, max_body_size, block);
+    // The window stays open for the whole run, the processes of the node are ordered by barriers
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, body_window);
+    synchronise_node();
+}
+
+/*
+* Make the writes of every process of the node to the shared body store visible to the others
+*/
+static void synchronise_node() {
+    if (!configuration.shared_bodies) return;
+    MPI_Win_sync(body_window);
+    MPI_Barrier(node_comm);
+    MPI_Win_sync(body_window);
+}
+
+/*
+* Give every node the bodies updated by the other nodes, the processes of a node already share theirs
+* The bodies of the processes of a node are contiguous, so the leaders gather one block per node
+*/
+static void exchange_node_blocks(MPI_Datatype type) {
+    synchronise_node();
+    if (node_rank == 0 && node_count > 1) {
+        for (int k = 0; k < node_count; k++) {
+            node_body_displacement[k] = gather_displacement[node_first[k]];
+            node_body_count[k] = 0;
+            for (int p = node_first[k]; p < node_first[k + 1]; p++) node_body_count[k] += gather_count[p];
+        }
+        MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, bodies.state, node_body_count, node_body_displacement,
+                       type, leader_comm);
+    }
+    synchronise_node();
+}
+
+/*
+* One timestep of the kick-drift-kick leapfrog or of the 4th order Yoshida integrator
+* The accelerations of the last kick of a step are those of the first kick of the next step, so they are only
+* computed again if this process has other bodies, a body appeared or a collision has changed them in between
+* Positions and velocities are in step at the end, so the collisions and the output see the same state as with Euler
+*/
+static void symplectic_step() {
+    if (start != accelerations_start || end != accelerations_end || number_active_bodies != accelerations_bodies ||
+        handled_collisions != accelerations_collisions)
+        compute_accelerations();
+    kick(kick_coefficients[0] * configuration.dt);
+    for (int k = 0; k < integrator_stages; k++) {
+        drift(drift_coefficients[k] * configuration.dt);
+        // The last forces are at the positions the collisions are checked at
+        record_contacts = configuration.fused_collisions && k == integrator_stages - 1;
+        if (configuration.overlap_communication) {
+            compute_overlapped_accelerations();
+        } else {
+            if (configuration.force_decomposition)
+                exchange_grid_positions();
+            else
+                exchange_positions();
+            compute_accelerations();
+        }
+        record_contacts = false;
+        kick(kick_coefficients[k + 1] * configuration.dt);
+    }
+}
+
+/*
+* One timestep of the Wisdom-Holman integrator in democratic heliocentric coordinates
+* Positions are taken relative to the sun and velocities relative to the barycentre, then the step is
+* kick(dt / 2), jump(dt / 2), Kepler drift(dt), jump(dt / 2), kick(dt / 2), where a kick only has the interactions
+* between bodies other than the sun, a jump moves every body by the momentum of all of them over the mass of the sun,
+* and the Kepler drift moves every body along its exact orbit around the sun
+* As the sun is handled analytically, the step only has to resolve the perturbations between the other bodies
+*/
+static void wisdom_holman_step() {
+    double total_mass = 0, mass_x = 0, mass_y = 0, mass_z = 0, momentum_x = 0, momentum_y = 0, momentum_z = 0;
+    double sun_mass = bodies.mass[central_body];
+    double mu = G_CONSTANT * sun_mass;
+    double sun_x = bodies.x[central_body], sun_y = bodies.y[central_body], sun_z = bodies.z[central_body];
+
+    if (start != accelerations_start || end != accelerations_end || number_active_bodies != accelerations_bodies ||
+        handled_collisions != accelerations_collisions)
+        compute_accelerations();
+
+    for (int i = 0; i < number_active_bodies; i++) {
+        if (bodies.active[i]) {
+            total_mass += bodies.mass[i];
+            mass_x += bodies.mass[i] * bodies.x[i];
+            mass_y += bodies.mass[i] * bodies.y[i];
+            mass_z += bodies.mass[i] * bodies.z[i];
+            momentum_x += bodies.mass[i] * bodies.velocity_x[i];
+            momentum_y += bodies.mass[i] * bodies.velocity_y[i];
+            momentum_z += bodies.mass[i] * bodies.velocity_z[i];
+        }
+    }
+    // Barycentre, which moves in a straight line
+    double centre_x = mass_x / total_mass, centre_y = mass_y / total_mass, centre_z = mass_z / total_mass;
+    double centre_velocity_x = momentum_x / total_mass;
+    double centre_velocity_y = momentum_y / total_mass;
+    double centre_velocity_z = momentum_z / total_mass;
+
+    // Every process converts every body, the momentum of the bodies other than the sun is needed by the first jump
+    double jump[3] = {0, 0, 0};
+    for (int i = 0; i < number_active_bodies; i++) {
+        if (bodies.active[i] && i != central_body) {
+            bodies.x[i] -= sun_x;
+            bodies.y[i] -= sun_y;
+            bodies.z[i] -= sun_z;
+            bodies.velocity_x[i] -= centre_velocity_x;
+            bodies.velocity_y[i] -= centre_velocity_y;
+            bodies.velocity_z[i] -= centre_velocity_z;
+            jump[0] += bodies.mass[i] * bodies.velocity_x[i];
+            jump[1] += bodies.mass[i] * bodies.velocity_y[i];
+            jump[2] += bodies.mass[i] * bodies.velocity_z[i];
+        }
+    }
+
+    double half_step = configuration.dt / 2;
+#pragma omp parallel for schedule(static)
+    for (int i = start; i < end; i++) {
+        if (bodies.active[i] && i != central_body) {
+            bodies.velocity_x[i] += bodies.acceleration_x[i] * half_step;
+            bodies.velocity_y[i] += bodies.acceleration_y[i] * half_step;
+            bodies.velocity_z[i] += bodies.acceleration_z[i] * half_step;
+            bodies.x[i] += jump[0] / sun_mass * half_step;
+            bodies.y[i] += jump[1] / sun_mass * half_step;
+            bodies.z[i] += jump[2] / sun_mass * half_step;
+            double position[3] = {bodies.x[i], bodies.y[i], bodies.z[i]};
+            double velocity[3] = {bodies.velocity_x[i], bodies.velocity_y[i], bodies.velocity_z[i]};
+            kepler_drift(mu, position, velocity, configuration.dt);
+            bodies.x[i] = position[0];
+            bodies.y[i] = position[1];
+            bodies.z[i] = position[2];
+            bodies.velocity_x[i] = velocity[0];
+            bodies.velocity_y[i] = velocity[1];
+            bodies.velocity_z[i] = velocity[2];
+        }
+    }
+
+    // The drift changed the momentum, sum it again over all processes for the second jump
+    jump[0] = jump[1] = jump[2] = 0;
+    for (int i = start; i < end; i++) {
+        if (bodies.active[i] && i != central_body) {
+            jump[0] += bodies.mass[i] * bodies.velocity_x[i];
+            jump[1] += bodies.mass[i] * bodies.velocity_y[i];
+            jump[2] += bodies.mass[i] * bodies.velocity_z[i];
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, jump, 3, MPI_DOUBLE, MPI_SUM, comm);
+    for (int i = start; i < end; i++) {
+        if (bodies.active[i] && i != central_body) {
+            bodies.x[i] += jump[0] / sun_mass * half_step;
+            bodies.y[i] += jump[1] / sun_mass * half_step;
+            bodies.z[i] += jump[2] / sun_mass * half_step;
+        }
+    }
+    exchange_positions();
+    compute_accelerations();
+
+    // Back to the frame of the simulation: the sun sits where the barycentre of all the bodies is where it should be,
+    // and its momentum balances the others, the kicks not changing the total momentum of the other bodies
+    mass_x = mass_y = mass_z = 0;
+    for (int i = 0; i < number_active_bodies; i++) {
+        if (bodies.active[i] && i != central_body) {
+            mass_x += bodies.mass[i] * bodies.x[i];
+            mass_y += bodies.mass[i] * bodies.y[i];
+            mass_z += bodies.mass[i] * bodies.z[i];
+        }
+    }
+    sun_x = centre_x + centre_velocity_x * configuration.dt - mass_x / total_mass;
+    sun_y = centre_y + centre_velocity_y * configuration.dt - mass_y / total_mass;
+    sun_z = centre_z + centre_velocity_z * configuration.dt - mass_z / total_mass;
+    bodies.x[central_body] = sun_x;
+    bodies.y[central_body] = sun_y;
+    bodies.z[central_body] = sun_z;
+    bodies.velocity_x[central_body] = centre_velocity_x - jump[0] / sun_mass;
+    bodies.velocity_y[central_body] = centre_velocity_y - jump[1] / sun_mass;
+    bodies.velocity_z[central_body] = centre_velocity_z - jump[2] / sun_mass;
+#pragma omp parallel for schedule(static)
+    for (int i = start; i < end; i++) {
+        if (bodies.active[i] && i != central_body) {
+            bodies.velocity_x[i] += bodies.acceleration_x[i] * half_step + centre_velocity_x;
+            bodies.velocity_y[i] += bodies.acceleration_y[i] * half_step + centre_velocity_y;
+            bodies.velocity_z[i] += bodies.acceleration_z[i] * half_step + centre_velocity_z;
+            bodies.x[i] += sun_x;
+            bodies.y[i] += sun_y;
+            bodies.z[i] += sun_z;
+        }
+    }
+}
+
+/*
+* One timestep of kick-drift-kick leapfrog with hierarchical block timesteps
+* The timestep is split into 2^BLOCK_LEVELS ticks, a body of level l is kicked every 2^(BLOCK_LEVELS - l) ticks, so
+* bodies only compute their acceleration as often as their own orbit needs
+* Every process drifts every body, which keeps the positions identical everywhere, so only the velocities and
+* accelerations of the bodies that were kicked in a substep are exchanged
+*/
+static void block_step() {
+    long int ticks = 1L << configuration.block_levels;
+    double tick_time = configuration.dt / ticks;
+    bool unassigned = false;
+    int finest = 0;
+
+    for (int i = 0; i < number_active_bodies; i++) {
+        if (bodies.active[i] && timestep_level[i] < 0) unassigned = true;
+    }
+    if (unassigned) choose_initial_levels();
+
+    // Every body starts a step at the start of the timestep
+#pragma omp parallel for schedule(static)
     for (int i = start; i < end; i++) {
-        if (bodies[i].active) {
-            bodies[i].x += bodies[i].velocity_x * configuration.dt;
-            bodies[i].y += bodies[i].velocity_y * configuration.dt;
-            bodies[i].z += bodies[i].velocity_z * configuration.dt;
+        if (bodies.active[i]) {
+            double half_step = configuration.dt / (1L << timestep_level[i]) / 2;
+            bodies.velocity_x[i] += bodies.acceleration_x[i] * half_step;
+            bodies.velocity_y[i] += bodies.acceleration_y[i] * half_step;
+            bodies.velocity_z[i] += bodies.acceleration_z[i] * half_step;
+        }
+    }
+    exchange_kicked_bodies(-1);
+
+    for (long int tick = 0; tick < ticks;) {
+        long int next = next_due_tick(tick);
+        double time = (next - tick) * tick_time;
+        for (int i = 0; i < number_active_bodies; i++) {
+            if (bodies.active[i]) {
+                bodies.x[i] += bodies.velocity_x[i] * time;
+                bodies.y[i] += bodies.velocity_y[i] * time;
+                bodies.z[i] += bodies.velocity_z[i] * time;
+                if (timestep_level[i] > finest) finest = timestep_level[i];
+            }
+        }
+        tick = next;
+
+        int count = 0;
+        for (int i = start; i < end; i++) {
+            if (bodies.active[i] && tick % (ticks >> timestep_level[i]) == 0) {
+                previous_acceleration[3 * count] = bodies.acceleration_x[i];
+                previous_acceleration[3 * count + 1] = bodies.acceleration_y[i];
+                previous_acceleration[3 * count + 2] = bodies.acceleration_z[i];
+                due_bodies[count++] = i;
+            }
+        }
+        compute_due_accelerations(count);
+        block_evaluations += count;
+
+        // Close the step with the new acceleration, choose the next level and open the next step
+#pragma omp parallel for schedule(static)
+        for (int k = 0; k < count; k++) {
+            int i = due_bodies[k];
+            int level = timestep_level[i];
+            double step = configuration.dt / (1L << level);
+            double jerk_x = (bodies.acceleration_x[i] - previous_acceleration[3 * k]) / step;
+            double jerk_y = (bodies.acceleration_y[i] - previous_acceleration[3 * k + 1]) / step;
+            double jerk_z = (bodies.acceleration_z[i] - previous_acceleration[3 * k + 2]) / step;
+            int new_level = timestep_level_for(i, sqrt(jerk_x * jerk_x + jerk_y * jerk_y + jerk_z * jerk_z));
+            // A body may go to a coarser level one at a time, and only where both step boundaries meet
+            if (new_level < level) {
+                new_level = level - 1;
+                if (tick % (ticks >> new_level) != 0) new_level = level;
+            }
+            double time = step / 2 + (tick < ticks ? configuration.dt / (1L << new_level) / 2 : 0);
+            bodies.velocity_x[i] += bodies.acceleration_x[i] * time;
+            bodies.velocity_y[i] += bodies.acceleration_y[i] * time;
+            bodies.velocity_z[i] += bodies.acceleration_z[i] * time;
+            timestep_level[i] = new_level;
         }
+        exchange_kicked_bodies(count);
     }
+    block_single_level_evaluations += (long int) (end - start) << finest;
 }
 
 /*
-* For a body will loop through every other active body and calculate the gravitational force interaction between them
+* Tick at which the next step of any body ends, after the given tick
 */
-static void update_body_acceleration(int index) {
-    struct body_struct *my_body = &bodies[index];
-    my_body->acceleration_x = 0;
-    my_body->acceleration_y = 0;
-    my_body->acceleration_z = 0;
+static long int next_due_tick(long int tick) {
+    long int ticks = 1L << configuration.block_levels;
+    long int next = ticks;
     for (int i = 0; i < number_active_bodies; i++) {
-        if (i != index && bodies[i].active) {
-            calculate_two_body_acceleration(my_body, &bodies[i]);
+        if (bodies.active[i]) {
+            long int period = ticks >> timestep_level[i];
+            long int due = (tick / period + 1) * period;
+            if (due < next) next = due;
         }
     }
+    return next;
+}
+
+/*
+* Level of the block timestep of a body from its acceleration and the given jerk: the step is BLOCK_ETA * |a| / |j|,
+* rounded down to dt / 2^level
+*/
+static int timestep_level_for(int i, double jerk) {
+    double acceleration = sqrt(bodies.acceleration_x[i] * bodies.acceleration_x[i] +
+                               bodies.acceleration_y[i] * bodies.acceleration_y[i] +
+                               bodies.acceleration_z[i] * bodies.acceleration_z[i]);
+    if (jerk <= 0 || acceleration <= 0) return 0;
+    double step = configuration.block_eta * acceleration / jerk;
+    int level = 0;
+    while (level < configuration.block_levels && configuration.dt / (1L << level) > step) level++;
+    return level;
+}
+
+/*
+* Choose the levels of every body of this process when bodies without a level appeared, i.e. at the start and after
+* comets or asteroid splits
+* The jerk is estimated from the accelerations at the current positions and after drifting all bodies by one tick
+*/
+static void choose_initial_levels() {
+    double time = configuration.dt / (1L << configuration.block_levels);
+    int count = 0;
+    for (int i = start; i < end; i++) {
+        if (bodies.active[i]) {
+            timestep_level[i] = 0;
+            due_bodies[count++] = i;
+        }
+    }
+    compute_due_accelerations(count);
+    for (int k = 0; k < count; k++) {
+        int i = due_bodies[k];
+        previous_acceleration[3 * k] = bodies.acceleration_x[i];
+        previous_acceleration[3 * k + 1] = bodies.acceleration_y[i];
+        previous_acceleration[3 * k + 2] = bodies.acceleration_z[i];
+    }
+    for (int i = 0; i < number_active_bodies; i++) {
+        bodies.x[i] += bodies.velocity_x[i] * time;
+        bodies.y[i] += bodies.velocity_y[i] * time;
+        bodies.z[i] += bodies.velocity_z[i] * time;
+    }
+    compute_due_accelerations(count);
+    for (int i = 0; i < number_active_bodies; i++) {
+        bodies.x[i] -= bodies.velocity_x[i] * time;
+        bodies.y[i] -= bodies.velocity_y[i] * time;
+        bodies.z[i] -= bodies.velocity_z[i] * time;
+    }
+    for (int k = 0; k < count; k++) {
+        int i = due_bodies[k];
+        double jerk_x = (bodies.acceleration_x[i] - previous_acceleration[3 * k]) / time;
+        double jerk_y = (bodies.acceleration_y[i] - previous_acceleration[3 * k + 1]) / time;
+        double jerk_z = (bodies.acceleration_z[i] - previous_acceleration[3 * k + 2]) / time;
+        bodies.acceleration_x[i] = previous_acceleration[3 * k];
+        bodies.acceleration_y[i] = previous_acceleration[3 * k + 1];
+        bodies.acceleration_z[i] = previous_acceleration[3 * k + 2];
+        timestep_level[i] = timestep_level_for(i, sqrt(jerk_x * jerk_x + jerk_y * jerk_y + jerk_z * jerk_z));
+    }
+    exchange_kicked_bodies(count);
+}
+
+/*
+* Computes the acceleration of the first count due bodies of this process from the current positions of all bodies
+* The solvers that work body by body only compute the due bodies, the others compute the whole range of the process
+* and the bodies that are not due keep the acceleration of their last kick
+*/
+static void compute_due_accelerations(int count) {
+    if (configuration.gravity_solver == TEST_PARTICLES)
+        pack_massive_sources();
+    else
+        pack_gravity_sources();
+    if (configuration.gravity_solver == SYMMETRIC_SUMMATION || configuration.gravity_solver == FAST_MULTIPOLE) {
+        for (int i = start; i < end; i++) {
+            range_acceleration[3 * (i - start)] = bodies.acceleration_x[i];
+            range_acceleration[3 * (i - start) + 1] = bodies.acceleration_y[i];
+            range_acceleration[3 * (i - start) + 2] = bodies.acceleration_z[i];
+        }
+        if (configuration.gravity_solver == SYMMETRIC_SUMMATION)
+            compute_symmetric_accelerations();
+        else
+            compute_fast_multipole_accelerations();
+        for (int k = 0; k < count; k++) {
+            int i = due_bodies[k];
+            range_acceleration[3 * (i - start)] = bodies.acceleration_x[i];
+            range_acceleration[3 * (i - start) + 1] = bodies.acceleration_y[i];
+            range_acceleration[3 * (i - start) + 2] = bodies.acceleration_z[i];
+        }
+        for (int i = start; i < end; i++) {
+            bodies.acceleration_x[i] = range_acceleration[3 * (i - start)];
+            bodies.acceleration_y[i] = range_acceleration[3 * (i - start) + 1];
+            bodies.acceleration_z[i] = range_acceleration[3 * (i - start) + 2];
+        }
+        return;
+    }
+    if (configuration.gravity_solver == BARNES_HUT) build_barnes_hut_tree(&tree, &sources);
+#pragma omp parallel for schedule(dynamic, 16)
+    for (int k = 0; k < count; k++) {
+        if (configuration.gravity_solver == BARNES_HUT)
+            update_body_acceleration_barnes_hut(due_bodies[k]);
+        else
+            update_body_acceleration(due_bodies[k],
+                                     configuration.gravity_solver == TEST_PARTICLES ? &massive : &sources);
+    }
+}
+
+/*
+* Give every process the velocity, acceleration and level of the first count due bodies of every process
+* With a count of -1, all the bodies of every process are exchanged
+*/
+static void exchange_kicked_bodies(int count) {
+    if (process.population <= 1) return;
+    if (count < 0) {
+        count = 0;
+        for (int i = start; i < end; i++) due_bodies[count++] = i;
+    }
+    for (int k = 0; k < count; k++) {
+        int i = due_bodies[k];
+        double *record = &kicked_records[8 * k];
+        record[0] = i;
+        record[1] = bodies.velocity_x[i];
+        record[2] = bodies.velocity_y[i];
+        record[3] = bodies.velocity_z[i];
+        record[4] = bodies.acceleration_x[i];
+        record[5] = bodies.acceleration_y[i];
+        record[6] = bodies.acceleration_z[i];
+        record[7] = timestep_level[i];
+    }
+    count *= 8;
+    MPI_Allgather(&count, 1, MPI_INT, record_count, 1, MPI_INT, comm);
+    int total = 0;
+    for (int p = 0; p < process.population; p++) {
+        record_displacement[p] = total;
+        total += record_count[p];
+    }
+    MPI_Allgatherv(kicked_records, count, MPI_DOUBLE, received_records, record_count, record_displacement,
+                   MPI_DOUBLE, comm);
+    for (int k = 0; k < total; k += 8) {
+        double *record = &received_records[k];
+        int i = (int) record[0];
+        bodies.velocity_x[i] = record[1];
+        bodies.velocity_y[i] = record[2];
+        bodies.velocity_z[i] = record[3];
+        bodies.acceleration_x[i] = record[4];
+        bodies.acceleration_y[i] = record[5];
+        bodies.acceleration_z[i] = record[6];
+        timestep_level[i] = (int) record[7];
+    }
+}
+
+/*
+* One step of the 4th order Hermite integrator, with one timestep shared by all bodies and chosen from the tolerance
+* Every body is predicted along its Taylor series to the jerk, the acceleration and jerk are computed at the predicted
+* state, and the Hermite interpolation between the old and the new ones gives the snap and crackle that correct it
+* As in IAS15, the error of a step is the last term of the acceleration polynomial, crackle * h^3 / 6, relative to the
+* acceleration: above HERMITE_TOLERANCE for any body the step is taken again shorter, and the next step is scaled so
+* that its error would just meet the tolerance
+* Steps are at most DT long and end exactly at every output time and at the end time
+*/
+static void hermite_step() {
+    double *position[3] = {bodies.x, bodies.y, bodies.z};
+    double *velocity[3] = {bodies.velocity_x, bodies.velocity_y, bodies.velocity_z};
+    double *acceleration[3] = {bodies.acceleration_x, bodies.acceleration_y, bodies.acceleration_z};
+    double tolerance = configuration.hermite_tolerance;
+
+    if (start != accelerations_start || end != accelerations_end || number_active_bodies != accelerations_bodies ||
+        handled_collisions != accelerations_collisions)
+        compute_hermite_forces();
+    if (hermite_step_time <= 0) hermite_step_time = hermite_initial_step();
+    double output_interval = configuration.output_frequency * configuration.dt;
+    double next_output = (floor(model_time / output_interval + 1e-9) + 1) * output_interval;
+    double target = fmin(next_output, configuration.end_time);
+    double step = fmin(fmin(hermite_step_time, configuration.dt), target - model_time);
+
+    for (int i = start; i < end; i++) {
+        double *saved = &hermite_start[12 * (i - start)];
+        for (int k = 0; k < 3; k++) {
+            saved[k] = position[k][i];
+            saved[3 + k] = velocity[k][i];
+            saved[6 + k] = acceleration[k][i];
+            saved[9 + k] = jerk[3 * i + k];
+        }
+    }
+
+    double error;
+    bool rejected = false;
+    while (true) {
+        double h = step;
+#pragma omp parallel for schedule(static)
+        for (int i = start; i < end; i++) {
+            if (!bodies.active[i]) continue;
+            double *saved = &hermite_start[12 * (i - start)];
+            for (int k = 0; k < 3; k++) {
+                position[k][i] = saved[k] + h * (saved[3 + k] + h * (saved[6 + k] / 2 + h * saved[9 + k] / 6));
+                velocity[k][i] = saved[3 + k] + h * (saved[6 + k] + h * saved[9 + k] / 2);
+            }
+        }
+        // The jerk needs the velocities of the other bodies as well as their positions
+        if (process.population > 1)
+            MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, bodies.state, gather_count, gather_displacement,
+                           body_dynamic_type, comm);
+        compute_hermite_forces();
+
+        error = 0;
+#pragma omp parallel for schedule(static) reduction(max:error)
+        for (int i = start; i < end; i++) {
+            if (!bodies.active[i]) continue;
+            double *saved = &hermite_start[12 * (i - start)];
+            double crackle_size = 0, acceleration_size = 0;
+            for (int k = 0; k < 3; k++) {
+                double change = saved[6 + k] - acceleration[k][i];
+                double snap = (-6 * change - h * (4 * saved[9 + k] + 2 * jerk[3 * i + k])) / (h * h);
+                double crackle = (12 * change + 6 * h * (saved[9 + k] + jerk[3 * i + k])) / (h * h * h);
+                position[k][i] += h * h * h * h * (snap / 24 + h * crackle / 120);
+                velocity[k][i] += h * h * h * (snap / 6 + h * crackle / 24);
+                crackle_size += crackle * crackle;
+                acceleration_size += acceleration[k][i] * acceleration[k][i];
+            }
+            if (acceleration_size > 0) error = fmax(error, sqrt(crackle_size / acceleration_size) * h * h * h / 6);
+        }
+        MPI_Allreduce(MPI_IN_PLACE, &error, 1, MPI_DOUBLE, MPI_MAX, comm);
+        if (error <= tolerance || step <= configuration.dt * HERMITE_SMALLEST_STEP) break;
+
+        rejected_steps++;
+        rejected = true;
+        for (int i = start; i < end; i++) {
+            double *saved = &hermite_start[12 * (i - start)];
+            for (int k = 0; k < 3; k++) {
+                acceleration[k][i] = saved[6 + k];
+                jerk[3 * i + k] = saved[9 + k];
+            }
+        }
+        step *= fmax(0.1, 0.9 * cbrt(tolerance / error));
+    }
+
+    if (step >= target - model_time) {
+        model_time = target;
+        output_due = target == next_output;
+    } else {
+        model_time += step;
+        output_due = false;
+    }
+    // A step cut short by an output time does not hold back the next one, but no step more than doubles
+    double limit = 2 * (rejected ? step : fmax(step, hermite_step_time));
+    hermite_step_time = error > 0 ? fmin(limit, 0.9 * step * cbrt(tolerance / error)) : limit;
+}
+
+/*
+* Computes the acceleration and jerk of the bodies of this process from the current positions and velocities of all
+* bodies, by direct summation over every active body, or over the massive ones with test particles
+*/
+static void compute_hermite_forces() {
+    struct gravity_sources *packed = configuration.gravity_solver == TEST_PARTICLES ? &massive : &sources;
+    if (configuration.gravity_solver == TEST_PARTICLES)
+        pack_massive_sources();
+    else
+        pack_gravity_sources();
+#pragma omp parallel for schedule(static)
+    for (int i = start; i < end; i++) {
+        if (bodies.active[i]) {
+            double position[3] = {bodies.x[i], bodies.y[i], bodies.z[i]};
+            double velocity[3] = {bodies.velocity_x[i], bodies.velocity_y[i], bodies.velocity_z[i]};
+            double acceleration[3] = {0, 0, 0}, body_jerk[3] = {0, 0, 0};
+            accumulate_acceleration_jerk(position, velocity, packed, 0, packed->count, acceleration, body_jerk);
+            bodies.acceleration_x[i] = G_CONSTANT * acceleration[0];
+            bodies.acceleration_y[i] = G_CONSTANT * acceleration[1];
+            bodies.acceleration_z[i] = G_CONSTANT * acceleration[2];
+            for (int k = 0; k < 3; k++) jerk[3 * i + k] = G_CONSTANT * body_jerk[k];
+        }
+    }
+    accelerations_start = start;
+    accelerations_end = end;
+    accelerations_bodies = number_active_bodies;
+    accelerations_collisions = handled_collisions;
+}
+
+/*
+* Length of the first Hermite step: with a crackle of about |j|^3 / |a|^2, a step h has an error of about
+* (h * |j| / |a|)^3 / 6, so a tenth of the step that would meet the tolerance for every body is taken and the
+* following steps grow from there
+*/
+static double hermite_initial_step() {
+    double step = configuration.dt;
+    for (int i = start; i < end; i++) {
+        if (!bodies.active[i]) continue;
+        double acceleration = sqrt(bodies.acceleration_x[i] * bodies.acceleration_x[i] +
+                                   bodies.acceleration_y[i] * bodies.acceleration_y[i] +
+                                   bodies.acceleration_z[i] * bodies.acceleration_z[i]);
+        double body_jerk = sqrt(jerk[3 * i] * jerk[3 * i] + jerk[3 * i + 1] * jerk[3 * i + 1] +
+                                jerk[3 * i + 2] * jerk[3 * i + 2]);
+        if (acceleration > 0 && body_jerk > 0)
+            step = fmin(step, 0.1 * cbrt(6 * configuration.hermite_tolerance) * acceleration / body_jerk);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &step, 1, MPI_DOUBLE, MPI_MIN, comm);
+    return step;
+}
+
+/*
+* Set up the coefficients of the configured symplectic integrator
+* Yoshida's integrator chains three leapfrog steps of w1 * dt, w0 * dt and w1 * dt, with w1 = 1 / (2 - 2^(1/3)) and
+* w0 = 1 - 2 * w1, merging the kicks where two of them meet
+*/
+static void select_integrator() {
+    if (configuration.integrator == YOSHIDA) {
+        double w1 = 1 / (2 - cbrt(2)), w0 = 1 - 2 * w1;
+        integrator_stages = 3;
+        kick_coefficients[0] = w1 / 2;
+        kick_coefficients[1] = (w1 + w0) / 2;
+        kick_coefficients[2] = (w0 + w1) / 2;
+        kick_coefficients[3] = w1 / 2;
+        drift_coefficients[0] = w1;
+        drift_coefficients[1] = w0;
+        drift_coefficients[2] = w1;
+    } else {
+        integrator_stages = 1;
+        kick_coefficients[0] = 0.5;
+        kick_coefficients[1] = 0.5;
+        drift_coefficients[0] = 1;
+    }
+}
+
+/*
+* Kinetic plus potential energy of the active bodies, summed over every pair
+*/
+static double total_energy() {
+    double energy = 0;
+#pragma omp parallel for schedule(dynamic, 16) reduction(+:energy)
+    for (int i = 0; i < number_active_bodies; i++) {
+        if (!bodies.active[i]) continue;
+        energy += 0.5 * bodies.mass[i] * (bodies.velocity_x[i] * bodies.velocity_x[i] +
+                                          bodies.velocity_y[i] * bodies.velocity_y[i] +
+                                          bodies.velocity_z[i] * bodies.velocity_z[i]);
+        for (int j = i + 1; j < number_active_bodies; j++) {
+            if (!bodies.active[j]) continue;
+            double dx = bodies.x[j] - bodies.x[i];
+            double dy = bodies.y[j] - bodies.y[i];
+            double dz = bodies.z[j] - bodies.z[i];
+            energy -= G_CONSTANT * bodies.mass[i] * bodies.mass[j] / sqrt(dx * dx + dy * dy + dz * dz);
+        }
+    }
+    return energy;
+}
+
+/*
+* Copy the position and mass of every active body into the packed source arrays used by the gravity kernel
+*/
+static void pack_gravity_sources() {
+    sources.count = pack_gravity_source_range(0, number_active_bodies, 0);
+}
+
+/*
+* Pack the active bodies in [first, last) into the sources from position count on, returns the new number of sources
+*/
+static int pack_gravity_source_range(int first, int last, int count) {
+    for (int i = first; i < last; i++) {
+        if (bodies.active[i] && i != central_body) {
+            sources.index[count] = i;
+            sources.x[count] = bodies.x[i];
+            sources.y[count] = bodies.y[i];
+            sources.z[count] = bodies.z[i];
+            if (sources.velocity_x != NULL) {
+                sources.velocity_x[count] = bodies.velocity_x[i];
+                sources.velocity_y[count] = bodies.velocity_y[i];
+                sources.velocity_z[count] = bodies.velocity_z[i];
+            }
+            sources.mass[count++] = bodies.mass[i];
+        }
+    }
+    return count;
+}
+
+/*
+* Refresh the positions of the massive sources used by the test particle solver
+* The selection itself is only redone when a collision has changed the mass of a massive body or removed it, or new
+* bodies appeared, every process sees the same bodies after the broadcast so they all select again at the same timestep
+*/
+static void pack_massive_sources() {
+    bool massive_stale = massive_selected_bodies != number_active_bodies;
+    for (int k = 0; k < massive.count && !massive_stale; k++) {
+        int i = massive.index[k];
+        if (!bodies.active[i] || bodies.mass[i] != massive.mass[k]) massive_stale = true;
+        massive.x[k] = bodies.x[i];
+        massive.y[k] = bodies.y[i];
+        massive.z[k] = bodies.z[i];
+        if (massive.velocity_x != NULL) {
+            massive.velocity_x[k] = bodies.velocity_x[i];
+            massive.velocity_y[k] = bodies.velocity_y[i];
+            massive.velocity_z[k] = bodies.velocity_z[i];
+        }
+    }
+    if (!massive_stale) return;
+
+    int count = 0;
+    for (int i = 0; i < number_active_bodies; i++) {
+        if (bodies.active[i] && i != central_body && ((bodies.type[i] != ASTEROID && bodies.type[i] != COMET) ||
+                                 bodies.mass[i] >= configuration.massive_asteroid_mass)) {
+            massive.index[count] = i;
+            massive.x[count] = bodies.x[i];
+            massive.y[count] = bodies.y[i];
+            massive.z[count] = bodies.z[i];
+            if (massive.velocity_x != NULL) {
+                massive.velocity_x[count] = bodies.velocity_x[i];
+                massive.velocity_y[count] = bodies.velocity_y[i];
+                massive.velocity_z[count] = bodies.velocity_z[i];
+            }
+            massive.mass[count++] = bodies.mass[i];
+        }
+    }
+    massive.count = count;
+    massive_selected_bodies = number_active_bodies;
+}
+
+/*
+* For a body will sum the gravitational interaction with every active body of the given sources, using the vectorised
+* kernel
+*/
+static void update_body_acceleration(int index, struct gravity_sources *sources) {
+    double acceleration[3] = {0, 0, 0};
+    accumulate_acceleration(bodies.x[index], bodies.y[index], bodies.z[index], sources, 0, sources->count,
+                            acceleration);
+    bodies.acceleration_x[index] = G_CONSTANT * acceleration[0];
+    bodies.acceleration_y[index] = G_CONSTANT * acceleration[1];
+    bodies.acceleration_z[index] = G_CONSTANT * acceleration[2];
+}
+
+/*
+* Sums the gravitational interaction of every active body in [first, last) with every other active body, in tiles of
+* the packed sources: each tile is small enough to stay in cache while all the bodies are summed against it, instead of
+* streaming all sources from memory again for every body
+* The bodies are split statically between the threads, a thread always gets the same bodies for every tile so the
+* threads never have to wait for each other between tiles
+* With fused collisions, the kernel also records the pairs closer than the sum of the radius of the body and the
+* largest radius while the distances are at hand, each thread keeps them in its own list and appends them to
+* contact_pairs at the end
+* Only the sources from source_first on are summed, the accelerations are reset when it is the first source and
+* multiplied by the gravitational constant when finish is set, so the sources can be summed in several parts. The main
+* thread keeps a pending exchange of the positions moving between tiles
+*/
+static void compute_tiled_accelerations(int first, int last, int tile, int source_first, bool finish) {
+    double largest_radius = 0;
+    if (record_contacts) {
+        if (source_first == 0) contact_count = 0;
+        contact_bodies = number_active_bodies;
+        // Over every body, not only the sources packed so far
+        for (int i = 0; i < number_active_bodies; i++) {
+            if (bodies.active[i] && i != central_body) largest_radius = fmax(largest_radius, bodies.radius[i]);
+        }
+    }
+#pragma omp parallel
+    {
+        int found = 0, capacity = 16;
+        long int *pairs = NULL;
+        int *contacts = NULL;
+        if (record_contacts) {
+            pairs = (long int *) malloc(sizeof(long int) * capacity);
+            contacts = (int *) malloc(sizeof(int) * tile);
+        }
+        if (source_first == 0) {
+#pragma omp for schedule(static) nowait
+            for (int i = first; i < last; i++) {
+                bodies.acceleration_x[i] = 0;
+                bodies.acceleration_y[i] = 0;
+                bodies.acceleration_z[i] = 0;
+            }
+        }
+        for (int tile_first = source_first; tile_first < sources.count; tile_first += tile) {
+            int tile_last = tile_first + tile < sources.count ? tile_first + tile : sources.count;
+#pragma omp master
+            {
+                int arrived;
+                if (position_request != MPI_REQUEST_NULL) MPI_Test(&position_request, &arrived, MPI_STATUS_IGNORE);
+            }
+#pragma omp for schedule(static) nowait
+            for (int i = first; i < last; i++) {
+                if (bodies.active[i]) {
+                    double acceleration[3] = {bodies.acceleration_x[i], bodies.acceleration_y[i],
+                                              bodies.acceleration_z[i]};
+                    if (record_contacts) {
+                        // Slightly further than any source could touch, checkForCollision decides on the pairs
+                        double distance = (bodies.radius[i] + largest_radius) * (1 + 1e-9);
+                        int touching = accumulate_acceleration_contacts(bodies.x[i], bodies.y[i], bodies.z[i],
+                                                                        distance, &sources, tile_first, tile_last,
+                                                                        acceleration, contacts);
+                        for (int k = 0; k < touching; k++) {
+                            int j = sources.index[contacts[k]];
+                            // Only keep the bodies after i, the body itself is recorded too
+                            if (j <= i) continue;
+                            if (found == capacity) {
+                                capacity *= 2;
+                                pairs = (long int *) realloc(pairs, sizeof(long int) * capacity);
+                            }
+                            pairs[found++] = (long int) i * max_body_size + j;
+                        }
+                    } else {
+                        accumulate_acceleration(bodies.x[i], bodies.y[i], bodies.z[i], &sources, tile_first,
+                                                tile_last, acceleration);
+                    }
+                    bodies.acceleration_x[i] = acceleration[0];
+                    bodies.acceleration_y[i] = acceleration[1];
+                    bodies.acceleration_z[i] = acceleration[2];
+                }
+            }
+        }
+        if (finish) {
+#pragma omp for schedule(static)
+            for (int i = first; i < last; i++) {
+                bodies.acceleration_x[i] *= G_CONSTANT;
+                bodies.acceleration_y[i] *= G_CONSTANT;
+                bodies.acceleration_z[i] *= G_CONSTANT;
+            }
+        }
+        if (record_contacts) {
+#pragma omp critical
+            {
+                if (contact_count + found > contact_capacity) {
+                    contact_capacity = (contact_count + found) * 2;
+                    contact_pairs = (long int *) realloc(contact_pairs, sizeof(long int) * contact_capacity);
+                }
+                memcpy(&contact_pairs[contact_count], pairs, sizeof(long int) * found);
+                contact_count += found;
+            }
+            free(pairs);
+            free(contacts);
+        }
+    }
+}
+
+/*
+* For a body will sum the gravitational interaction with every other active body, approximating distant groups of
+* bodies with the octree built at the start of compute_velocity
+*/
+static void update_body_acceleration_barnes_hut(int index) {
+    double acceleration[3] = {0, 0, 0};
+    barnes_hut_acceleration(&tree, bodies.x[index], bodies.y[index], bodies.z[index], configuration.barnes_hut_theta,
+                            acceleration);
+    bodies.acceleration_x[index] = G_CONSTANT * acceleration[0];
+    bodies.acceleration_y[index] = G_CONSTANT * acceleration[1];
+    bodies.acceleration_z[index] = G_CONSTANT * acceleration[2];
+}
+
+/*
+* Computes the acceleration of the active bodies of this process with the fast multipole method
+* The tree is built over every active body, the walk only descends into nodes that hold bodies of this process
+*/
+static void compute_fast_multipole_accelerations() {
+    build_barnes_hut_tree(&fmm_tree, &sources);
+    fast_multipole_accelerations(&fmm, &fmm_tree, configuration.fmm_theta, start, end);
+    for (int k = 0; k < fmm_tree.sorted.count; k++) {
+        if (fmm.target[k]) {
+            int index = fmm_tree.sorted.index[k];
+            bodies.acceleration_x[index] = G_CONSTANT * fmm.acceleration_x[k];
+            bodies.acceleration_y[index] = G_CONSTANT * fmm.acceleration_y[k];
+            bodies.acceleration_z[index] = G_CONSTANT * fmm.acceleration_z[k];
+        }
+    }
+}
+
+/*
+ * Compare the Barnes-Hut solver against direct summation for the initial bodies and a range of opening angles
+ * Up to 1000 evenly spread bodies are sampled, the relative error of the acceleration of each is |a_bh - a| / |a|
+ * This gives the data to choose BARNES_HUT_THETA for a run
+ */
+static void report_barnes_hut_accuracy() {
+    double thetas[6] = {0.1, 0.2, 0.3, 0.5, 0.7, 1.0};
+    struct timeval timer;
+
+    pack_gravity_sources();
+    int samples = sources.count < 1000 ? sources.count : 1000;
+    double *exact = (double *) malloc(sizeof(double) * 3 * samples);
+    gettimeofday(&timer, NULL);
+    for (int k = 0; k < samples; k++) {
+        int i = (int) ((long int) k * sources.count / samples);
+        exact[3 * k] = exact[3 * k + 1] = exact[3 * k + 2] = 0;
+        accumulate_acceleration(sources.x[i], sources.y[i], sources.z[i], &sources, 0, sources.count, &exact[3 * k]);
+    }
+    double direct_time = getElapsedTime(timer);
+    printf("Barnes-Hut accuracy against direct summation for %d of %d bodies (direct summation: %.4f seconds)\n",
+           samples, sources.count, direct_time);
+
+    gettimeofday(&timer, NULL);
+    build_barnes_hut_tree(&tree, &sources);
+    printf("Octree built in %.4f seconds, %d nodes\n", getElapsedTime(timer), tree.node_count);
+    for (int t = 0; t < 6; t++) {
+        double max_error = 0, sum_error = 0;
+        gettimeofday(&timer, NULL);
+        for (int k = 0; k < samples; k++) {
+            int i = (int) ((long int) k * sources.count / samples);
+            double acceleration[3] = {0, 0, 0};
+            barnes_hut_acceleration(&tree, sources.x[i], sources.y[i], sources.z[i], thetas[t], acceleration);
+            double error = sqrt(pow(acceleration[0] - exact[3 * k], 2) + pow(acceleration[1] - exact[3 * k + 1], 2) +
+                                pow(acceleration[2] - exact[3 * k + 2], 2)) /
+                           sqrt(pow(exact[3 * k], 2) + pow(exact[3 * k + 1], 2) + pow(exact[3 * k + 2], 2));
+            if (error > max_error) max_error = error;
+            sum_error += error * error;
+        }
+        printf("theta=%.1f: max relative error %.3e, rms relative error %.3e, %.4f seconds\n", thetas[t], max_error,
+               sqrt(sum_error / samples), getElapsedTime(timer));
+    }
+    printf("------------------------------------------------\n");
+    free(exact);
+}
+
+/*
+ * Time the direct summation of the initial bodies without tiles and with a range of tile sizes
+ * Every process streams all of the sources for each of its bodies without tiles, which no longer fits in cache once
+ * there are more than a few thousand bodies, so the time per interaction shows the cost of the cache misses
+ * This gives the data to choose TILE_SIZE for a machine
+ */
+static void report_tile_sizes() {
+    int tiles[6] = {0, 256, 1024, 4096, 16384, tile_size};
+    struct timeval timer;
+
+    pack_gravity_sources();
+    printf("Direct summation of %d bodies, %ld bytes of sources, L1 data cache of %ld bytes, L2 cache of %ld bytes\n",
+           sources.count, (long int) sources.count * 4 * sizeof(double), sysconf(_SC_LEVEL1_DCACHE_SIZE),
+           sysconf(_SC_LEVEL2_CACHE_SIZE));
+    for (int t = 0; t < 6; t++) {
+        int tile = tiles[t] > 0 ? tiles[t] : sources.count + 1;
+        gettimeofday(&timer, NULL);
+        compute_tiled_accelerations(0, number_active_bodies, tile, 0, true);
+        double time = getElapsedTime(timer);
+        if (tiles[t] == 0)
+            printf("untiled: %.4f seconds, %.3f ns per interaction\n", time,
+                   time * 1e9 / ((double) sources.count * sources.count));
+        else
+            printf("tile size %d%s: %.4f seconds, %.3f ns per interaction\n", tiles[t], t == 5 ? " (selected)" : "",
+                   time, time * 1e9 / ((double) sources.count * sources.count));
+    }
+    printf("------------------------------------------------\n");
+}
+
+/*
+ * Update the rows of the triangle of pairs (i, j > i) that this process evaluates
+ * Row i holds count - 1 - i pairs, so rows are split to give every process about the same number of pairs
+ */
+static void update_pair_range(int count) {
+    long int total = (long int) count * (count - 1) / 2;
+    long int first_pair = total * process.id / process.population;
+    long int last_pair = total * (process.id + 1) / process.population;
+    long int done = 0;
+
+    pair_start = count;
+    pair_end = count;
+    for (int i = 0; i < count; i++) {
+        if (pair_start == count && done >= first_pair) pair_start = i;
+        if (done >= last_pair) {
+            pair_end = i;
+            break;
+        }
+        done += count - 1 - i;
+    }
+}
+
+/*
+* Computes the acceleration of every active body evaluating each pair only once
+* The contribution of a pair is added to one body and subtracted (scaled by mass) from the other, each process sums
+* its rows of pairs into its own buffer and the buffers are added up across processes at the end
+*/
+static void compute_symmetric_accelerations() {
+    int count = sources.count;
+    double *acceleration_x = pair_acceleration;
+    double *acceleration_y = acceleration_x + count;
+    double *acceleration_z = acceleration_y + count;
+
+    memset(pair_acceleration, 0, sizeof(double) * 3 * count * num_threads);
+    update_pair_range(count);
+#pragma omp parallel
+    {
+        // Every thread accumulates into its own copy of the buffer, the copies are summed before the reduction
+        double *thread_x = pair_acceleration + (long int) 3 * count * omp_get_thread_num();
+        double *thread_y = thread_x + count;
+        double *thread_z = thread_y + count;
+#pragma omp for schedule(dynamic, 16)
+        for (int i = pair_start; i < pair_end; i++) {
+            double acceleration[3] = {0, 0, 0};
+            accumulate_pair_row(sources.x[i], sources.y[i], sources.z[i], sources.mass[i], &sources, i + 1, count,
+                                acceleration, thread_x, thread_y, thread_z);
+            thread_x[i] += acceleration[0];
+            thread_y[i] += acceleration[1];
+            thread_z[i] += acceleration[2];
+        }
+#pragma omp for schedule(static)
+        for (int k = 0; k < 3 * count; k++) {
+            for (int t = 1; t < num_threads; t++) pair_acceleration[k] += pair_acceleration[(long int) 3 * count * t + k];
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, pair_acceleration, 3 * count, MPI_DOUBLE, MPI_SUM, comm);
+
+    for (int k = 0; k < count; k++) {
+        // Only the bodies of this process, the store may be shared with the other processes of the node
+        if (sources.index[k] < start || sources.index[k] >= end) continue;
+        bodies.acceleration_x[sources.index[k]] = G_CONSTANT * acceleration_x[k];
+        bodies.acceleration_y[sources.index[k]] = G_CONSTANT * acceleration_y[k];
+        bodies.acceleration_z[sources.index[k]] = G_CONSTANT * acceleration_z[k];
+    }
 }
 
 /*
@@ -404,12 +2252,12 @@ static void update_body_acceleration(int index) {
 */
 static void store_history(char *filename) {
     for (int i = 0; i < number_active_bodies; i++) {
-        bodies_history[i].history_x[history_index] = bodies[i].x;
-        bodies_history[i].history_y[history_index] = bodies[i].y;
-        bodies_history[i].history_z[history_index] = bodies[i].z;
+        bodies_history[i].history_x[history_index] = bodies.x[i];
+        bodies_history[i].history_y[history_index] = bodies.y[i];
+        bodies_history[i].history_z[history_index] = bodies.z[i];
     }
     history_index++;
-    if (history_index >= MAX_HISTORY_SIZE) {
+    if (history_index >= history_size) {
         dump_history_to_file(filename);
         history_index = 0;
     }
@@ -423,9 +2271,9 @@ static void dump_history_to_file(char *filename) {
     file_output_num++;
     for (int i = 0; i < number_active_bodies; i++) {
         for (int j = 0; j < history_index; j++) {
-            fprintf(file, "%s_x=%f\n", bodies[i].name, bodies_history[i].history_x[j]);
-            fprintf(file, "%s_y=%f\n", bodies[i].name, bodies_history[i].history_y[j]);
-            fprintf(file, "%s_z=%f\n", bodies[i].name, bodies_history[i].history_z[j]);
+            fprintf(file, "%s_x=%f\n", bodies.metadata[i].name, bodies_history[i].history_x[j]);
+            fprintf(file, "%s_y=%f\n", bodies.metadata[i].name, bodies_history[i].history_y[j]);
+            fprintf(file, "%s_z=%f\n", bodies.metadata[i].name, bodies_history[i].history_z[j]);
         }
     }
     fclose(file);
@@ -438,29 +2286,82 @@ static void dump_history_to_file(char *filename) {
 static void initialise_bodies(struct simulation_configuration_struct *configuration) {
     int currentBody = 0;
     max_body_size = configuration->body_size;
-    bodies = (struct body_struct *) malloc(sizeof(struct body_struct) * max_body_size);
+    if (configuration->shared_bodies)
+        share_body_store();
+    else
+        allocate_body_store(&bodies, max_body_size);
+    // With shared bodies, only the leader of the node fills in the store
+    bool fill = !configuration->shared_bodies || node_rank == 0;
+    allocate_gravity_sources(&sources, max_body_size);
+    allocate_gravity_sources(&massive, max_body_size);
+    num_threads = omp_get_max_threads();
+    // Only the symmetric summation keeps the partial accelerations of every thread
+    if (configuration->gravity_solver == SYMMETRIC_SUMMATION)
+        pair_acceleration = (double *) malloc(sizeof(double) * 3 * max_body_size * num_threads);
+    if (configuration->integrator == BLOCK) {
+        timestep_level = (int *) malloc(sizeof(int) * max_body_size);
+        for (int i = 0; i < max_body_size; i++) timestep_level[i] = -1;
+        due_bodies = (int *) malloc(sizeof(int) * max_body_size);
+        previous_acceleration = (double *) malloc(sizeof(double) * 3 * max_body_size);
+        range_acceleration = (double *) malloc(sizeof(double) * 3 * max_body_size);
+        kicked_records = (double *) malloc(sizeof(double) * 8 * max_body_size);
+        received_records = (double *) malloc(sizeof(double) * 8 * max_body_size);
+        record_count = (int *) malloc(sizeof(int) * process.population);
+        record_displacement = (int *) malloc(sizeof(int) * process.population);
+    }
+    if (configuration->integrator == HERMITE) {
+        jerk = (double *) malloc(sizeof(double) * 3 * max_body_size);
+        hermite_start = (double *) malloc(sizeof(double) * 12 * max_body_size);
+        allocate_gravity_source_velocities(&sources, max_body_size);
+        allocate_gravity_source_velocities(&massive, max_body_size);
+    }
+    allocate_barnes_hut_tree(&tree, max_body_size, BARNES_HUT_LEAF_SIZE);
+    if (configuration->broad_phase == SORT_AND_SWEEP)
+        allocate_sort_and_sweep(&sweep, max_body_size);
+    else
+        allocate_spatial_hash(&collision_hash, max_body_size);
+    if (configuration->swept_collisions) {
+        step_start_x = (double *) malloc(sizeof(double) * max_body_size);
+        step_start_y = (double *) malloc(sizeof(double) * max_body_size);
+        step_start_z = (double *) malloc(sizeof(double) * max_body_size);
+    }
+    if (configuration->scheduled_collisions) allocate_collision_schedule(&schedule, max_body_size);
+    if (configuration->gravity_solver == FAST_MULTIPOLE) {
+        allocate_barnes_hut_tree(&fmm_tree, max_body_size, FAST_MULTIPOLE_LEAF_SIZE);
+        allocate_fast_multipole(&fmm, configuration->fmm_order, max_body_size);
+    }
+    // Keep fewer history entries per body when there are too many bodies to hold MAX_HISTORY_SIZE of them
+    history_size = (int) fmin(MAX_HISTORY_SIZE, HISTORY_MEMORY_BUDGET / (3.0 * sizeof(double) * max_body_size));
+    if (history_size < 1) history_size = 1;
     bodies_history = (struct body_history *) malloc(sizeof(struct body_history) * max_body_size);
     for (int i = 0; i < max_body_size; i++) {
-        if (configuration->body_configurations[i].active) {
-            strcpy(bodies[currentBody].name, configuration->body_configurations[i].name);
-            bodies[currentBody].x = configuration->body_configurations[i].x;
-            bodies[currentBody].y = configuration->body_configurations[i].y;
-            bodies[currentBody].z = configuration->body_configurations[i].z;
-            bodies[currentBody].mass = configuration->body_configurations[i].mass;
-            bodies[currentBody].radius = configuration->body_configurations[i].radius;
-            bodies[currentBody].velocity_x = configuration->body_configurations[i].velocity_x;
-            bodies[currentBody].velocity_y = configuration->body_configurations[i].velocity_y;
-            bodies[currentBody].velocity_z = configuration->body_configurations[i].velocity_z;
-            bodies[currentBody].type = configuration->body_configurations[i].type;
-            bodies[currentBody].active = true;
-            bodies_history[currentBody].history_x = (double *) malloc(sizeof(double) * MAX_HISTORY_SIZE);
-            bodies_history[currentBody].history_y = (double *) malloc(sizeof(double) * MAX_HISTORY_SIZE);
-            bodies_history[currentBody].history_z = (double *) malloc(sizeof(double) * MAX_HISTORY_SIZE);
-            int type = bodies[currentBody].type;
+        if (configuration->body_configurations[i].active && !fill) {
+            if (configuration->body_configurations[i].type == ASTEROID) num_asteroids++;
+            if (configuration->body_configurations[i].type == COMET) num_comets++;
+            currentBody++;
+        } else if (configuration->body_configurations[i].active) {
+            strcpy(bodies.metadata[currentBody].name, configuration->body_configurations[i].name);
+            bodies.x[currentBody] = configuration->body_configurations[i].x;
+            bodies.y[currentBody] = configuration->body_configurations[i].y;
+            bodies.z[currentBody] = configuration->body_configurations[i].z;
+            bodies.mass[currentBody] = configuration->body_configurations[i].mass;
+            bodies.radius[currentBody] = configuration->body_configurations[i].radius;
+            bodies.velocity_x[currentBody] = configuration->body_configurations[i].velocity_x;
+            bodies.velocity_y[currentBody] = configuration->body_configurations[i].velocity_y;
+            bodies.velocity_z[currentBody] = configuration->body_configurations[i].velocity_z;
+            bodies.type[currentBody] = configuration->body_configurations[i].type;
+            bodies.active[currentBody] = true;
+            // Only process 0 stores the history
+            if (process.id == 0) {
+                bodies_history[currentBody].history_x = (double *) malloc(sizeof(double) * history_size);
+                bodies_history[currentBody].history_y = (double *) malloc(sizeof(double) * history_size);
+                bodies_history[currentBody].history_z = (double *) malloc(sizeof(double) * history_size);
+            }
+            int type = bodies.type[currentBody];
             if (type < 3) {
                 // Initialize collision counts
-                bodies[currentBody].collided_asteroids = 0;
-                bodies[currentBody].collided_comets = 0;
+                bodies.metadata[currentBody].collided_asteroids = 0;
+                bodies.metadata[currentBody].collided_comets = 0;
             } else if (type == 3) {
                 num_asteroids++;
             } else if (type == 4) {
@@ -470,6 +2371,7 @@ static void initialise_bodies(struct simulation_configuration_struct *configurat
         }
     }
     number_active_bodies = currentBody;
+    synchronise_node();
 }
 
 /*
@@ -522,19 +2424,168 @@ static void initialise_function(int argc, char *argv[]) {
      */
     gather_count = (int *) malloc(process.population * sizeof(int));
     gather_displacement = (int *) malloc(process.population * sizeof(int));
+    collision_count = (int *) malloc(process.population * sizeof(int));
+    collision_displacement = (int *) malloc(process.population * sizeof(int));
 
     parseConfiguration(argv[1], &configuration);
     filename = argv[2];
 
+    if (configuration.shared_bodies && ((configuration.integrator != EULER && configuration.integrator != LEAPFROG &&
+                                         configuration.integrator != YOSHIDA) ||
+                                        configuration.scheduled_collisions)) {
+        if (process.id == 0)
+            fprintf(stderr, "Shared bodies need Euler, leapfrog or Yoshida and no scheduled collisions, giving every "
+                            "process its own bodies\n");
+        configuration.shared_bodies = false;
+    }
+    if (configuration.shared_bodies) {
+        MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, process.id, MPI_INFO_NULL, &node_comm);
+        MPI_Comm_rank(node_comm, &node_rank);
+        // The bodies of a node are exchanged as one block, which needs the processes of a node to be consecutive
+        int leader = process.id - node_rank, consecutive;
+        MPI_Bcast(&leader, 1, MPI_INT, 0, node_comm);
+        consecutive = leader == process.id - node_rank;
+        MPI_Allreduce(MPI_IN_PLACE, &consecutive, 1, MPI_INT, MPI_LAND, comm);
+        if (!consecutive) {
+            if (process.id == 0)
+                fprintf(stderr, "The processes of a node are not consecutive, giving every process its own bodies\n");
+            MPI_Comm_free(&node_comm);
+            configuration.shared_bodies = false;
+        }
+    }
+    if (configuration.shared_bodies) {
+        MPI_Comm_split(comm, node_rank == 0 ? 0 : MPI_UNDEFINED, process.id, &leader_comm);
+        if (node_rank == 0) {
+            MPI_Comm_size(leader_comm, &node_count);
+            node_first = (int *) malloc(sizeof(int) * (node_count + 1));
+            node_body_count = (int *) malloc(sizeof(int) * node_count);
+            node_body_displacement = (int *) malloc(sizeof(int) * node_count);
+            MPI_Allgather(&process.id, 1, MPI_INT, node_first, 1, MPI_INT, leader_comm);
+            node_first[node_count] = process.population;
+        }
+    }
+    if (configuration.shared_bodies && (configuration.force_decomposition || configuration.overlap_communication)) {
+        if (process.id == 0)
+            fprintf(stderr, "Shared bodies are exchanged by the leaders of the nodes, without force decomposition nor "
+                            "overlapped communication\n");
+        configuration.force_decomposition = false;
+        configuration.overlap_communication = false;
+    }
     initialise_bodies(&configuration);
+    select_gravity_kernel();
+    tile_size = configuration.tile_size > 0 ? configuration.tile_size : gravity_tile_size();
+    select_integrator();
+    if (configuration.integrator == WISDOM_HOLMAN) {
+        for (int i = 0; i < number_active_bodies && central_body < 0; i++) {
+            if (bodies.type[i] == SUN) central_body = i;
+        }
+        if (central_body < 0) {
+            if (process.id == 0) fprintf(stderr, "No SUN body for the Wisdom-Holman integrator, using leapfrog\n");
+            configuration.integrator = LEAPFROG;
+        }
+    }
+    if (configuration.integrator == HERMITE && configuration.gravity_solver != DIRECT_SUMMATION &&
+        configuration.gravity_solver != TEST_PARTICLES) {
+        if (process.id == 0) fprintf(stderr, "The Hermite integrator needs the jerk, using direct summation\n");
+        configuration.gravity_solver = DIRECT_SUMMATION;
+    }
+    exchange_velocities = configuration.integrator == HERMITE || configuration.integrator == WISDOM_HOLMAN ||
+                          configuration.scheduled_collisions;
+    if (configuration.fused_collisions) {
+        if ((configuration.integrator != LEAPFROG && configuration.integrator != YOSHIDA) ||
+            configuration.gravity_solver != DIRECT_SUMMATION || configuration.swept_collisions ||
+            configuration.scheduled_collisions) {
+            if (process.id == 0)
+                fprintf(stderr, "Fused collisions need leapfrog or Yoshida with direct summation and neither swept "
+                                "nor scheduled collisions, checking collisions separately\n");
+            configuration.fused_collisions = false;
+        }
+    }
+    grid_size = (int) lround(sqrt(process.population));
+    if (configuration.force_decomposition && (grid_size * grid_size != process.population ||
+                                              configuration.gravity_solver != DIRECT_SUMMATION ||
+                                              (configuration.integrator != EULER &&
+                                               configuration.integrator != LEAPFROG &&
+                                               configuration.integrator != YOSHIDA) ||
+                                              configuration.scheduled_collisions || configuration.fused_collisions)) {
+        if (process.id == 0)
+            fprintf(stderr, "The force decomposition needs a square number of processes, Euler, leapfrog or Yoshida "
+                            "with direct summation, and neither scheduled nor fused collisions, "
+                            "splitting the forces by rows\n");
+        configuration.force_decomposition = false;
+    }
+    if (configuration.force_decomposition) {
+        grid_row = process.id / grid_size;
+        grid_column = process.id % grid_size;
+        MPI_Comm_split(comm, grid_row, grid_column, &row_comm);
+        partial_accelerations = (double *) malloc(sizeof(double) * 3 * max_body_size);
+        row_counts = (int *) malloc(sizeof(int) * grid_size);
+        row_displacements = (int *) malloc(sizeof(int) * grid_size);
+        grid_member = (bool *) calloc(max_body_size, sizeof(bool));
+    }
+    if (configuration.overlap_communication && ((configuration.integrator != LEAPFROG &&
+                                                 configuration.integrator != YOSHIDA) ||
+                                                configuration.gravity_solver != DIRECT_SUMMATION ||
+                                                configuration.force_decomposition)) {
+        if (process.id == 0)
+            fprintf(stderr, "Overlapped communication needs leapfrog or Yoshida with direct summation and no force "
+                            "decomposition, exchanging the positions before the forces\n");
+        configuration.overlap_communication = false;
+    }
+    if (configuration.load_balance && ((configuration.integrator != EULER && configuration.integrator != LEAPFROG &&
+                                        configuration.integrator != YOSHIDA) ||
+                                       configuration.force_decomposition || configuration.scheduled_collisions)) {
+        if (process.id == 0)
+            fprintf(stderr, "Load balancing needs Euler, leapfrog or Yoshida and neither force decomposition nor "
+                            "scheduled collisions, splitting the bodies evenly\n");
+        configuration.load_balance = false;
+    }
+    if (configuration.load_balance) {
+        balance_times = (double *) malloc(sizeof(double) * process.population);
+        balance_first = (int *) malloc(sizeof(int) * (process.population + 1));
+    }
 
     if (process.id == 0) {
         printf("MPI initialized, number of threads: %d\n", process.population);
-        printf("Simulation configured for %d bodies, timesteps=%d dt=%f\n", number_active_bodies,
-               configuration.num_timesteps, configuration.dt);
+        printf("OpenMP threads per process: %d\n", num_threads);
+        if (configuration.integrator == HERMITE)
+            printf("Simulation configured for %d bodies, end time=%.0f seconds, dt=%f at most\n",
+                   number_active_bodies, configuration.end_time, configuration.dt);
+        else
+            printf("Simulation configured for %d bodies, timesteps=%d dt=%f\n", number_active_bodies,
+                   configuration.num_timesteps, configuration.dt);
         printf("Number of asteroids in the asteroids belt: %d\n", configuration.asteroid_belt);
         printf("Number of asteroids in the Kuiper Belt: %d\n", configuration.kuiper_belt);
+        printf("Gravity kernel: %s\n", gravity_kernel_name());
+        if (configuration.gravity_solver == BARNES_HUT)
+            printf("Gravity solver: Barnes-Hut, theta=%.2f\n", configuration.barnes_hut_theta);
+        else if (configuration.gravity_solver == TEST_PARTICLES)
+            printf("Gravity solver: test particles, asteroids and comets lighter than %g kg are massless\n",
+                   configuration.massive_asteroid_mass);
+        else if (configuration.gravity_solver == FAST_MULTIPOLE)
+            printf("Gravity solver: fast multipole, order=%d theta=%.2f\n", fmm.order, configuration.fmm_theta);
+        else if (configuration.gravity_solver == SYMMETRIC_SUMMATION)
+            printf("Gravity solver: symmetric summation\n");
+        else
+            printf("Gravity solver: direct summation, tile size %d\n", tile_size);
+        if (configuration.force_decomposition)
+            printf("Force decomposition: %d x %d grid of processes\n", grid_size, grid_size);
+        if (configuration.integrator == WISDOM_HOLMAN)
+            printf("Integrator: Wisdom-Holman around %s\n", bodies.metadata[central_body].name);
+        else if (configuration.integrator == HERMITE)
+            printf("Integrator: 4th order Hermite with adaptive timesteps, tolerance=%g\n",
+                   configuration.hermite_tolerance);
+        else if (configuration.integrator == BLOCK)
+            printf("Integrator: kick-drift-kick leapfrog with block timesteps, %d levels below dt, eta=%.3f\n",
+                   configuration.block_levels, configuration.block_eta);
+        else
+            printf("Integrator: %s\n", configuration.integrator == YOSHIDA ? "4th order Yoshida" :
+                                       configuration.integrator == LEAPFROG ? "kick-drift-kick leapfrog" :
+                                       "semi-implicit Euler");
         printf("------------------------------------------------\n");
+        if (configuration.barnes_hut_report) report_barnes_hut_accuracy();
+        if (configuration.tile_report) report_tile_sizes();
+        if (configuration.energy_report) initial_energy = total_energy();
     }
 
     gettimeofday(&start_time, NULL);
@@ -548,51 +2599,49 @@ static void initialise_function(int argc, char *argv[]) {
 //    srand(time(0));
 
     /*
-     * Commit struct bodies to MPI
+     * Commit the body store to MPI
+     * A body is a column of the state block: one double in each field, fields being max_body_size doubles apart
+     * Resizing the column to the extent of one double makes consecutive bodies consecutive elements of the type,
+     * so a range of bodies can be passed to MPI as &bodies.state[start] and a count
      */
-    int length[16] = {40, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1};
-    MPI_Aint displacement[16];
-    MPI_Datatype types[16] = {MPI_CHAR, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE,
-                              MPI_DOUBLE,
-                              MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE, MPI_DOUBLE, MPI_C_BOOL, MPI_INT, MPI_INT, MPI_INT};
+    MPI_Datatype column_type;
+    MPI_Type_vector(3, 1, max_body_size, MPI_DOUBLE, &column_type);
+    MPI_Type_create_resized(column_type, 0, sizeof(double), &body_position_type);
+    MPI_Type_commit(&body_position_type);
+    MPI_Type_free(&column_type);
+    MPI_Type_vector(NUM_BODY_DYNAMIC_FIELDS, 1, max_body_size, MPI_DOUBLE, &column_type);
+    MPI_Type_create_resized(column_type, 0, sizeof(double), &body_dynamic_type);
+    MPI_Type_commit(&body_dynamic_type);
+    MPI_Type_free(&column_type);
+    // The acceleration is left out, it only matters to the process that computed it
+    int state_fields[NUM_BODY_STATE_FIELDS - 3];
+    for (int k = 0; k < NUM_BODY_STATE_FIELDS - 3; k++)
+        state_fields[k] = (k < NUM_BODY_DYNAMIC_FIELDS ? k : k + 3) * max_body_size;
+    MPI_Type_create_indexed_block(NUM_BODY_STATE_FIELDS - 3, 1, state_fields, MPI_DOUBLE, &column_type);
+    MPI_Type_create_resized(column_type, 0, sizeof(double), &body_state_type);
+    MPI_Type_commit(&body_state_type);
+    MPI_Type_free(&column_type);
+
+    /*
+     * Commit the cold side table entry to MPI
+     */
+    int length[3] = {40, 1, 1};
+    MPI_Aint displacement[3];
+    MPI_Datatype types[3] = {MPI_CHAR, MPI_INT, MPI_INT};
 
     // Define displacement and address
-    struct body_struct dummy_body;
+    struct body_metadata dummy_metadata;
     MPI_Aint base_address;
-    MPI_Get_address(&dummy_body, &base_address);
-    MPI_Get_address(&dummy_body.name[0], &displacement[0]);
-    MPI_Get_address(&dummy_body.x, &displacement[1]);
-    MPI_Get_address(&dummy_body.y, &displacement[2]);
-    MPI_Get_address(&dummy_body.z, &displacement[3]);
-    MPI_Get_address(&dummy_body.mass, &displacement[4]);
-    MPI_Get_address(&dummy_body.velocity_x, &displacement[5]);
-    MPI_Get_address(&dummy_body.velocity_y, &displacement[6]);
-    MPI_Get_address(&dummy_body.velocity_z, &displacement[7]);
-    MPI_Get_address(&dummy_body.acceleration_x, &displacement[8]);
-    MPI_Get_address(&dummy_body.acceleration_y, &displacement[9]);
-    MPI_Get_address(&dummy_body.acceleration_z, &displacement[10]);
-    MPI_Get_address(&dummy_body.radius, &displacement[11]);
-    MPI_Get_address(&dummy_body.active, &displacement[12]);
-    MPI_Get_address(&dummy_body.type, &displacement[13]);
-    MPI_Get_address(&dummy_body.collided_asteroids, &displacement[14]);
-    MPI_Get_address(&dummy_body.collided_asteroids, &displacement[15]);
+    MPI_Get_address(&dummy_metadata, &base_address);
+    MPI_Get_address(&dummy_metadata.name[0], &displacement[0]);
+    MPI_Get_address(&dummy_metadata.collided_asteroids, &displacement[1]);
+    MPI_Get_address(&dummy_metadata.collided_comets, &displacement[2]);
     displacement[0] = MPI_Aint_diff(displacement[0], base_address);
     displacement[1] = MPI_Aint_diff(displacement[1], base_address);
     displacement[2] = MPI_Aint_diff(displacement[2], base_address);
-    displacement[3] = MPI_Aint_diff(displacement[3], base_address);
-    displacement[4] = MPI_Aint_diff(displacement[4], base_address);
-    displacement[5] = MPI_Aint_diff(displacement[5], base_address);
-    displacement[6] = MPI_Aint_diff(displacement[6], base_address);
-    displacement[7] = MPI_Aint_diff(displacement[7], base_address);
-    displacement[8] = MPI_Aint_diff(displacement[8], base_address);
-    displacement[9] = MPI_Aint_diff(displacement[9], base_address);
-    displacement[10] = MPI_Aint_diff(displacement[10], base_address);
-    displacement[11] = MPI_Aint_diff(displacement[11], base_address);
-    displacement[12] = MPI_Aint_diff(displacement[12], base_address);
-    displacement[13] = MPI_Aint_diff(displacement[13], base_address);
-    displacement[14] = MPI_Aint_diff(displacement[14], base_address);
-    displacement[15] = MPI_Aint_diff(displacement[15], base_address);
-
-    MPI_Type_create_struct(16, length, displacement, types, &bodies_type);
-    MPI_Type_commit(&bodies_type);
-}
+
+    MPI_Type_create_struct(3, length, displacement, types, &column_type);
+    MPI_Type_create_resized(column_type, 0, sizeof(struct body_metadata), &body_metadata_type);
+    MPI_Type_commit(&body_metadata_type);
+    MPI_Type_free(&column_type);
+}
\ No newline at end of file
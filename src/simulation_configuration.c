@@ -24,6 +24,12 @@ static double drandom(double low, double high);
 
 static enum body_type_enum getBodyType(char *);
 
+static enum gravity_solver_enum getGravitySolver(char *);
+
+static enum integrator_enum getIntegrator(char *);
+
+static enum broad_phase_enum getBroadPhase(char *);
+
 /*
  * This function will generate a certain number of asteroids between Mars and Jupiter
  * Note that the number of asteroids can be specified in the configuration files
@@ -193,11 +199,63 @@ void parseConfiguration(char *filename, struct simulation_configuration_struct *
                     simulation_configuration->kuiper_belt = getIntValue(buffer);
                 if (strstr(buffer, "NUM_TIMESTEPS") != NULL)
                     simulation_configuration->num_timesteps = getIntValue(buffer);
+                if (strstr(buffer, "END_TIME") != NULL)
+                    simulation_configuration->end_time = getDoubleValue(buffer);
                 if (strstr(buffer, "OUTPUT_FREQUENCY") != NULL)
                     simulation_configuration->output_frequency = getIntValue(buffer);
                 if (strstr(buffer, "DISPLAY_PROGRESS_FREQUENCY") != NULL)
                     simulation_configuration->display_progess_frequency = getIntValue(buffer);
                 if (strstr(buffer, "DT") != NULL) simulation_configuration->dt = getDoubleValue(buffer);
+                if (strstr(buffer, "GRAVITY_SOLVER") != NULL) {
+                    char *equalsLocation = strchr(buffer, '=');
+                    simulation_configuration->gravity_solver = getGravitySolver(&equalsLocation[1]);
+                }
+                if (strstr(buffer, "BARNES_HUT_THETA") != NULL)
+                    simulation_configuration->barnes_hut_theta = getDoubleValue(buffer);
+                if (strstr(buffer, "BARNES_HUT_REPORT") != NULL)
+                    simulation_configuration->barnes_hut_report = getIntValue(buffer) != 0;
+                if (strstr(buffer, "FMM_ORDER") != NULL)
+                    simulation_configuration->fmm_order = getIntValue(buffer);
+                if (strstr(buffer, "FMM_THETA") != NULL)
+                    simulation_configuration->fmm_theta = getDoubleValue(buffer);
+                if (strstr(buffer, "MASSIVE_ASTEROID_MASS") != NULL)
+                    simulation_configuration->massive_asteroid_mass = getDoubleValue(buffer);
+                if (strstr(buffer, "TILE_SIZE") != NULL)
+                    simulation_configuration->tile_size = getIntValue(buffer);
+                if (strstr(buffer, "TILE_REPORT") != NULL)
+                    simulation_configuration->tile_report = getIntValue(buffer) != 0;
+                if (strstr(buffer, "INTEGRATOR") != NULL) {
+                    char *equalsLocation = strchr(buffer, '=');
+                    simulation_configuration->integrator = getIntegrator(&equalsLocation[1]);
+                }
+                if (strstr(buffer, "ENERGY_REPORT") != NULL)
+                    simulation_configuration->energy_report = getIntValue(buffer) != 0;
+                if (strstr(buffer, "BLOCK_LEVELS") != NULL)
+                    simulation_configuration->block_levels = getIntValue(buffer);
+                if (strstr(buffer, "BLOCK_ETA") != NULL)
+                    simulation_configuration->block_eta = getDoubleValue(buffer);
+                if (strstr(buffer, "SWEPT_COLLISIONS") != NULL)
+                    simulation_configuration->swept_collisions = getIntValue(buffer) != 0;
+                if (strstr(buffer, "SCHEDULED_COLLISIONS") != NULL)
+                    simulation_configuration->scheduled_collisions = getIntValue(buffer) != 0;
+                if (strstr(buffer, "COLLISION_SCHEDULE_STEPS") != NULL)
+                    simulation_configuration->collision_schedule_steps = getIntValue(buffer);
+                if (strstr(buffer, "FUSED_COLLISIONS") != NULL)
+                    simulation_configuration->fused_collisions = getIntValue(buffer) != 0;
+                if (strstr(buffer, "COLLISION_BROAD_PHASE") != NULL) {
+                    char *equalsLocation = strchr(buffer, '=');
+                    simulation_configuration->broad_phase = getBroadPhase(&equalsLocation[1]);
+                }
+                if (strstr(buffer, "OVERLAP_COMMUNICATION") != NULL)
+                    simulation_configuration->overlap_communication = getIntValue(buffer) != 0;
+                if (strstr(buffer, "FORCE_DECOMPOSITION") != NULL)
+                    simulation_configuration->force_decomposition = getIntValue(buffer) != 0;
+                if (strstr(buffer, "SHARED_BODIES") != NULL)
+                    simulation_configuration->shared_bodies = getIntValue(buffer) != 0;
+                if (strstr(buffer, "LOAD_BALANCE") != NULL)
+                    simulation_configuration->load_balance = getIntValue(buffer) != 0;
+                if (strstr(buffer, "HERMITE_TOLERANCE") != NULL)
+                    simulation_configuration->hermite_tolerance = getDoubleValue(buffer);
                 if (strstr(buffer, "BODY_") != NULL) {
                     int bodyNumber = getEntityNumber(buffer);
                     if (bodyNumber >= 0) {
@@ -249,6 +307,12 @@ void parseConfiguration(char *filename, struct simulation_configuration_struct *
         }
     }
     fclose(f);
+    // An end time replaces the number of timesteps, the fixed timestep integrators round it up to whole timesteps
+    if (simulation_configuration->end_time > 0)
+        simulation_configuration->num_timesteps =
+                (int) ceil(simulation_configuration->end_time / simulation_configuration->dt - 1e-9);
+    else
+        simulation_configuration->end_time = simulation_configuration->num_timesteps * simulation_configuration->dt;
     /*
      * If the allocated size of the array is not enough, then exit the program
      * Even if the size is enough to store bodies for now, problems may occur due to generation of new bodies.
@@ -281,8 +345,31 @@ static void initialiseSimulationConfiguration(struct simulation_configuration_st
     // Default values
     simulation_configuration->dt = 1.0;
     simulation_configuration->num_timesteps = 1000;
+    simulation_configuration->end_time = 0;
     simulation_configuration->output_frequency = 10;
     simulation_configuration->display_progess_frequency = 10000;
+    simulation_configuration->gravity_solver = DIRECT_SUMMATION;
+    simulation_configuration->barnes_hut_theta = 0.5;
+    simulation_configuration->barnes_hut_report = false;
+    simulation_configuration->fmm_order = 6;
+    simulation_configuration->fmm_theta = 0.5;
+    simulation_configuration->massive_asteroid_mass = HUGE_VAL;
+    simulation_configuration->tile_size = 0;
+    simulation_configuration->tile_report = false;
+    simulation_configuration->integrator = EULER;
+    simulation_configuration->energy_report = false;
+    simulation_configuration->block_levels = 16;
+    simulation_configuration->block_eta = 0.01;
+    simulation_configuration->hermite_tolerance = 1e-6;
+    simulation_configuration->swept_collisions = false;
+    simulation_configuration->scheduled_collisions = false;
+    simulation_configuration->collision_schedule_steps = 100;
+    simulation_configuration->fused_collisions = false;
+    simulation_configuration->broad_phase = SPATIAL_HASH;
+    simulation_configuration->overlap_communication = false;
+    simulation_configuration->force_decomposition = false;
+    simulation_configuration->shared_bodies = false;
+    simulation_configuration->load_balance = false;
     simulation_configuration->asteroid_belt = ASTEROID_BELT; // Initialise the number of asteroids in the asteroid belt
     simulation_configuration->kuiper_belt = KUIPER_BELT; // Initialise the number of asteroids in the Kuiper Belt
 
@@ -320,6 +407,7 @@ static int getEntityNumber(char *sourceString) {
             int size_diff = secondUnderScoreLocation - underScoreLocation;
             char int_key[size_diff];
             strncpy(int_key, &underScoreLocation[1], size_diff - 1);
+            int_key[size_diff - 1] = '\0';
             return atoi(int_key);
         }
     }
@@ -373,3 +461,40 @@ static enum body_type_enum getBodyType(char *sourceString) {
     if (strcmp(sourceString, "COMET") == 0) return COMET;
     return UNKNOWN;
 }
+
+/*
+* Maps from the string to the gravity solver, unknown names fall back to direct summation
+*/
+static enum gravity_solver_enum getGravitySolver(char *sourceString) {
+    if (strcmp(sourceString, "SYMMETRIC") == 0) return SYMMETRIC_SUMMATION;
+    if (strcmp(sourceString, "BARNES_HUT") == 0) return BARNES_HUT;
+    if (strcmp(sourceString, "FMM") == 0) return FAST_MULTIPOLE;
+    if (strcmp(sourceString, "TEST_PARTICLES") == 0) return TEST_PARTICLES;
+    if (strcmp(sourceString, "DIRECT") != 0)
+        fprintf(stderr, "Unknown gravity solver '%s', using direct summation\n", sourceString);
+    return DIRECT_SUMMATION;
+}
+
+/*
+* Maps from the string to the integrator, unknown names fall back to semi-implicit Euler
+*/
+static enum integrator_enum getIntegrator(char *sourceString) {
+    if (strcmp(sourceString, "LEAPFROG") == 0) return LEAPFROG;
+    if (strcmp(sourceString, "YOSHIDA") == 0) return YOSHIDA;
+    if (strcmp(sourceString, "BLOCK") == 0) return BLOCK;
+    if (strcmp(sourceString, "WISDOM_HOLMAN") == 0) return WISDOM_HOLMAN;
+    if (strcmp(sourceString, "HERMITE") == 0) return HERMITE;
+    if (strcmp(sourceString, "EULER") != 0)
+        fprintf(stderr, "Unknown integrator '%s', using semi-implicit Euler\n", sourceString);
+    return EULER;
+}
+
+/*
+* Maps from the string to the collision broad phase, unknown names fall back to the spatial hash
+*/
+static enum broad_phase_enum getBroadPhase(char *sourceString) {
+    if (strcmp(sourceString, "SORT_AND_SWEEP") == 0) return SORT_AND_SWEEP;
+    if (strcmp(sourceString, "SPATIAL_HASH") != 0)
+        fprintf(stderr, "Unknown collision broad phase '%s', using the spatial hash\n", sourceString);
+    return SPATIAL_HASH;
+}
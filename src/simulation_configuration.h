@@ -7,6 +7,18 @@
 // Maximum number of history entries allowed before writing to file
 #define MAX_HISTORY_SIZE 10000
 
+// Memory in bytes that the history of all bodies may take, fewer entries are kept before writing to file above it
+#define HISTORY_MEMORY_BUDGET 1073741824.0
+
+// Hermite steps this fraction of DT long are never rejected, so that an error that does not shrink can not stall a run
+#define HERMITE_SMALLEST_STEP 1e-12
+
+// The ranges of the processes are balanced again once the slowest process takes this fraction longer than the average
+#define LOAD_IMBALANCE_TOLERANCE 0.05
+
+// Timesteps the processes are timed over before the split of the bodies may move again
+#define LOAD_BALANCE_INTERVAL 10
+
 // Maximum number of bodies that can be configured
 #define MAX_BODY_CONFIGS 100
 
@@ -16,6 +28,31 @@
 // Default number of asteroids in the kuiper belt between Mars and Jupiter
 #define KUIPER_BELT 0
 
+// Algorithm used to compute the gravitational acceleration of bodies
+enum gravity_solver_enum {
+    DIRECT_SUMMATION = 0, // every body sums the interaction with every other body
+    SYMMETRIC_SUMMATION = 1, // every pair is evaluated once and applied to both bodies (Newton's third law)
+    BARNES_HUT = 2, // distant groups of bodies are approximated by their centre of mass in an octree
+    FAST_MULTIPOLE = 3, // distant groups of bodies interact through multipole and local expansions in an octree
+    TEST_PARTICLES = 4 // asteroids and comets are massless, only the sun, planets and moons act upon other bodies
+};
+
+// Algorithm used to advance the bodies over a timestep
+enum integrator_enum {
+    EULER = 0, // semi-implicit Euler: kick with the accelerations, then drift with the new velocities
+    LEAPFROG = 1, // kick-drift-kick leapfrog, 2nd order and symplectic
+    YOSHIDA = 2, // three leapfrog steps with Yoshida's coefficients, 4th order and symplectic
+    BLOCK = 3, // kick-drift-kick leapfrog where every body has its own power of two fraction of the timestep
+    WISDOM_HOLMAN = 4, // orbits around the sun are solved exactly, the steps only resolve the other interactions
+    HERMITE = 5 // 4th order Hermite predictor-corrector whose shared timestep is chosen from an error tolerance
+};
+
+// Algorithm used to find the pairs of bodies that may collide
+enum broad_phase_enum {
+    SPATIAL_HASH = 0, // bodies are put into a grid of cells, only neighbouring cells are checked
+    SORT_AND_SWEEP = 1 // bodies are kept sorted along x, only overlapping intervals are checked
+};
+
 // Configuration of each body as read from the configuration file
 // this is separate from the structure used when actually running the code
 struct body_config_struct {
@@ -32,6 +69,29 @@ struct simulation_configuration_struct {
   double dt;
   int body_size, asteroid_belt, kuiper_belt;
   int num_timesteps, output_frequency, display_progess_frequency;
+  double end_time; // simulated seconds to run for, num_timesteps * dt unless END_TIME is given
+  enum gravity_solver_enum gravity_solver;
+  double barnes_hut_theta; // opening angle of the Barnes-Hut solver
+  bool barnes_hut_report; // compare Barnes-Hut against direct summation before the simulation starts
+  int fmm_order; // expansion order of the fast multipole solver
+  double fmm_theta; // opening angle of the fast multipole solver
+  double massive_asteroid_mass; // asteroids and comets at least this heavy still act upon others as test particles
+  int tile_size; // sources per tile of the direct summation, 0 to pick it from the size of the L1 data cache
+  bool tile_report; // time the direct summation with a range of tile sizes before the simulation starts
+  enum integrator_enum integrator;
+  bool energy_report; // report the relative error of the total energy at the end of the simulation
+  int block_levels; // block timesteps go down to dt / 2^block_levels
+  double block_eta; // block timestep of a body is at most block_eta * |acceleration| / |jerk|
+  double hermite_tolerance; // largest relative change of an acceleration left out of the Hermite polynomial per step
+  bool swept_collisions; // check collisions along the straight path of the bodies over a timestep, not only at its end
+  bool scheduled_collisions; // only check pairs of bodies once they could have come into contact
+  int collision_schedule_steps; // timesteps between two full collision checks of the scheduled collisions
+  bool fused_collisions; // look for overlapping bodies in the force loop instead of in a separate pass
+  enum broad_phase_enum broad_phase;
+  bool overlap_communication; // sum the forces of the bodies of this process while the other positions are in flight
+  bool force_decomposition; // split the direct summation over a square grid of processes, rows of targets by sources
+  bool shared_bodies; // the processes of a node share one copy of the bodies in an MPI-3 shared memory window
+  bool load_balance; // split the bodies between the processes by the time they took in the last timestep
   struct body_config_struct *body_configurations;
 };
 
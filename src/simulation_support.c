@@ -6,86 +6,158 @@
 #include <string.h>
 #include <stdbool.h>
 
-// Gravitational constant
-#define G_CONSTANT 6.67408e-11
 /*
  * Edge of solar system
  * Reference: NASA Science. Accessed: https://solarsystem.nasa.gov/news/1164/how-big-is-the-solar-system/
  */
 #define SOLAR_SYSTEM_RADIUS 4.5e12
 
-static void update_body_momentum_elastic_collision(struct body_struct *, struct body_struct *);
+static void update_body_momentum_elastic_collision(struct body_store *, int, int);
 
 static double l2norm(double, double, double);
 
 static double drandom(double low, double high);
 
+/*
+ * Allocate a body store that can hold up to capacity bodies
+ */
+void allocate_body_store(struct body_store *bodies, int capacity) {
+    place_body_store(bodies, capacity, calloc(body_store_size(capacity), 1));
+}
+
+/*
+ * Number of bytes of the block that place_body_store carves a body store of the given capacity out of
+ */
+size_t body_store_size(int capacity) {
+    return (size_t) capacity * (NUM_BODY_STATE_FIELDS * sizeof(double) + sizeof(struct body_metadata) +
+                                sizeof(enum body_type_enum) + sizeof(bool));
+}
+
+/*
+ * Lay a body store that can hold up to capacity bodies over a zeroed block of body_store_size(capacity) bytes
+ * All double fields come first, in the order they are declared in body_store, then the metadata, types and flags
+ */
+void place_body_store(struct body_store *bodies, int capacity, void *block) {
+    bodies->capacity = capacity;
+    bodies->state = (double *) block;
+    bodies->x = bodies->state;
+    bodies->y = bodies->x + capacity;
+    bodies->z = bodies->y + capacity;
+    bodies->velocity_x = bodies->z + capacity;
+    bodies->velocity_y = bodies->velocity_x + capacity;
+    bodies->velocity_z = bodies->velocity_y + capacity;
+    bodies->acceleration_x = bodies->velocity_z + capacity;
+    bodies->acceleration_y = bodies->acceleration_x + capacity;
+    bodies->acceleration_z = bodies->acceleration_y + capacity;
+    bodies->mass = bodies->acceleration_z + capacity;
+    bodies->radius = bodies->mass + capacity;
+    bodies->metadata = (struct body_metadata *) (bodies->radius + capacity);
+    bodies->type = (enum body_type_enum *) (bodies->metadata + capacity);
+    bodies->active = (bool *) (bodies->type + capacity);
+}
+
 /*
 * Checks for a collision between two spheres by checking whether the centres of the two objects are separated by less than the sum 
 * of their radii. If so then it will be a collision (note we assume perfect speheres here, this is a simplification of the real
 * world but fine for our purposes).
 */
-bool checkForCollision(struct body_struct *body1, struct body_struct *body2) {
-    double distance_centres = sqrt(
-            pow(body1->x - body2->x, 2) + pow(body1->y - body2->y, 2) + pow(body1->z - body2->z, 2));
-    return distance_centres < body1->radius + body2->radius;
+bool checkForCollision(struct body_store *bodies, int body1, int body2) {
+    // Compare the squared distance of the centres, which needs no square root
+    double dx = bodies->x[body1] - bodies->x[body2];
+    double dy = bodies->y[body1] - bodies->y[body2];
+    double dz = bodies->z[body1] - bodies->z[body2];
+    double contact = bodies->radius[body1] + bodies->radius[body2];
+    return dx * dx + dy * dy + dz * dz < contact * contact;
+}
+
+/*
+* Checks for a collision between two spheres during the last timestep, assuming that both moved in a straight line from
+* their start positions to their current ones, so that fast bodies can not pass through each other within a timestep
+* Returns the fraction of the timestep at which the spheres first touched, or -1 if they did not. Spheres that already
+* touched at the start only collide if they are still getting closer, so that bodies that bounced off each other do not
+* collide again
+*/
+double checkForSweptCollision(struct body_store *bodies, double *start_x, double *start_y, double *start_z, int body1,
+                              int body2) {
+    // Relative position at the start and relative displacement over the timestep
+    double px = start_x[body2] - start_x[body1];
+    double py = start_y[body2] - start_y[body1];
+    double pz = start_z[body2] - start_z[body1];
+    double dx = bodies->x[body2] - bodies->x[body1] - px;
+    double dy = bodies->y[body2] - bodies->y[body1] - py;
+    double dz = bodies->z[body2] - bodies->z[body1] - pz;
+    double contact = bodies->radius[body1] + bodies->radius[body2];
+    // The squared distance at fraction s of the timestep is a * s^2 + 2 * b * s + p.p
+    double a = dx * dx + dy * dy + dz * dz;
+    double b = px * dx + py * dy + pz * dz;
+    double c = px * px + py * py + pz * pz - contact * contact;
+    if (b >= 0) return -1;
+    if (c < 0) return 0;
+    double discriminant = b * b - a * c;
+    if (discriminant < 0) return -1;
+    double s = (-b - sqrt(discriminant)) / a;
+    return s <= 1 ? s : -1;
 }
 
 /*
-* Calculates the acceleration resulting on the gravity imposed by the interaction of two bodies, this code is based on a
-* function that can be found at http://www.cyber-omelette.com/2016/11/python-n-body-orbital-simulation.html
+* Shortest time before two spheres could touch, if neither accelerates by more than acceleration_bound
+* Their relative velocity then changes by at most 2 * acceleration_bound per second, so the gap between them closes by
+* at most |v| * t + acceleration_bound * t^2 within a time t
 */
-void calculate_two_body_acceleration(struct body_struct *acted_upon_body, struct body_struct *acting_upon_body) {
-    double r = pow((acted_upon_body->x - acting_upon_body->x), 2);
-    r += pow((acted_upon_body->y - acting_upon_body->y), 2);
-    r += pow((acted_upon_body->z - acting_upon_body->z), 2);
-    r = sqrt(r);
-
-    double tmp = (G_CONSTANT * acting_upon_body->mass) / pow(r, 3);
-    acted_upon_body->acceleration_x += tmp * (acting_upon_body->x - acted_upon_body->x);
-    acted_upon_body->acceleration_y += tmp * (acting_upon_body->y - acted_upon_body->y);
-    acted_upon_body->acceleration_z += tmp * (acting_upon_body->z - acted_upon_body->z);
+double earliest_contact_time(struct body_store *bodies, int body1, int body2, double acceleration_bound) {
+    double dx = bodies->x[body2] - bodies->x[body1];
+    double dy = bodies->y[body2] - bodies->y[body1];
+    double dz = bodies->z[body2] - bodies->z[body1];
+    double gap = sqrt(dx * dx + dy * dy + dz * dz) - bodies->radius[body1] - bodies->radius[body2];
+    if (gap <= 0) return 0;
+    double wx = bodies->velocity_x[body2] - bodies->velocity_x[body1];
+    double wy = bodies->velocity_y[body2] - bodies->velocity_y[body1];
+    double wz = bodies->velocity_z[body2] - bodies->velocity_z[body1];
+    double speed = sqrt(wx * wx + wy * wy + wz * wz);
+    // Positive root of acceleration_bound * t^2 + speed * t - gap, in a form that holds without acceleration
+    return 2 * gap / (speed + sqrt(speed * speed + 4 * acceleration_bound * gap));
 }
 
 /*
 * Collision between a planet and asteroid (or comet), the planet is so much larger it will obtain the mass of the asteroid 
 * (or comet) and the  asteroid (or comet) is destroyed
 */
-void handle_planet_asteroid_collision(struct body_struct *planet_body, struct body_struct *asteroid_body) {
-    planet_body->mass += asteroid_body->mass;
-    asteroid_body->active = false;
-    if(asteroid_body->type == ASTEROID)
-        planet_body->collided_asteroids++;
+void handle_planet_asteroid_collision(struct body_store *bodies, int planet_body, int asteroid_body) {
+    bodies->mass[planet_body] += bodies->mass[asteroid_body];
+    bodies->active[asteroid_body] = false;
+    if(bodies->type[asteroid_body] == ASTEROID)
+        bodies->metadata[planet_body].collided_asteroids++;
     else
-        planet_body->collided_comets++;
+        bodies->metadata[planet_body].collided_comets++;
 }
 
 
 /*
 * Updates velocity for two asteroids that collide based on how they collide, their mass and initial velocities.
+* Whether the two asteroids split is drawn by the caller
 * If the two asteroids are determined not to split, then return false
 * If the two asteroids are determined to split, then return true
 * Note that the generation of new asteroids relates to adding new elements to the array, to reduce parameters passing,
 * generation work is done by another function named split_asteroid()
 */
-bool handle_asteroid_asteroid_collision(struct body_struct *body1, struct body_struct *body2) {
-    if (rand() % 10 == 0) {
-        body1->active = false;
-        body2->active = false;
+bool handle_asteroid_asteroid_collision(struct body_store *bodies, int body1, int body2, bool split) {
+    if (split) {
+        bodies->active[body1] = false;
+        bodies->active[body2] = false;
 
         return true;
     }
 
-    update_body_momentum_elastic_collision(body1, body2);
-    update_body_momentum_elastic_collision(body2, body1);
+    update_body_momentum_elastic_collision(bodies, body1, body2);
+    update_body_momentum_elastic_collision(bodies, body2, body1);
 
-    body1->velocity_x = body1->acceleration_x;
-    body1->velocity_y = body1->acceleration_y;
-    body1->velocity_z = body1->acceleration_z;
+    bodies->velocity_x[body1] = bodies->acceleration_x[body1];
+    bodies->velocity_y[body1] = bodies->acceleration_y[body1];
+    bodies->velocity_z[body1] = bodies->acceleration_z[body1];
 
-    body2->velocity_x = body2->acceleration_x;
-    body2->velocity_y = body2->acceleration_y;
-    body2->velocity_z = body2->acceleration_z;
+    bodies->velocity_x[body2] = bodies->acceleration_x[body2];
+    bodies->velocity_y[body2] = bodies->acceleration_y[body2];
+    bodies->velocity_z[body2] = bodies->acceleration_z[body2];
 
     return false;
 }
@@ -94,35 +166,36 @@ bool handle_asteroid_asteroid_collision(struct body_struct *body1, struct body_s
 * Collision between asteroid and comet, the asteroid's velocity is updated based on the collision and then the comet is 
 * destroyed
 */
-void handle_asteroid_comet_collision(struct body_struct *asteroid_body, struct body_struct *comet_body) {
-    update_body_momentum_elastic_collision(asteroid_body, comet_body);
-    asteroid_body->velocity_x = asteroid_body->acceleration_x;
-    asteroid_body->velocity_y = asteroid_body->acceleration_y;
-    asteroid_body->velocity_z = asteroid_body->acceleration_z;
+void handle_asteroid_comet_collision(struct body_store *bodies, int asteroid_body, int comet_body) {
+    update_body_momentum_elastic_collision(bodies, asteroid_body, comet_body);
+    bodies->velocity_x[asteroid_body] = bodies->acceleration_x[asteroid_body];
+    bodies->velocity_y[asteroid_body] = bodies->acceleration_y[asteroid_body];
+    bodies->velocity_z[asteroid_body] = bodies->acceleration_z[asteroid_body];
 
-    comet_body->active = false;
+    bodies->active[comet_body] = false;
 }
 
 /*
 * Collision between two comets, this simply destroys them both
 */
-void handle_comet_comet_collision(struct body_struct *body1, struct body_struct *body2) {
-    body1->active = false;
-    body2->active = false;
+void handle_comet_comet_collision(struct body_store *bodies, int body1, int body2) {
+    bodies->active[body1] = false;
+    bodies->active[body2] = false;
 }
 
 /*
  * Simulate comets' occurrence
  */
-bool random_comet(struct body_struct *body) {
+bool random_comet(struct body_store *bodies, int body) {
     if (rand() % 3000000 == 0) {
         /*
          * To place a comet at the edge of the solar system with a random position
          * The position must satisfy: x^2 + y^2 + z^2 = SOLAR_SYSTEM_EDGE^2
          */
-        body->x = drandom(0, SOLAR_SYSTEM_RADIUS);
-        body->y = drandom(0, sqrt(pow(SOLAR_SYSTEM_RADIUS, 2) - pow(body->x, 2)));
-        body->z = drandom(0, sqrt(pow(SOLAR_SYSTEM_RADIUS, 2) - pow(body->x, 2) - pow(body->y, 2)));
+        bodies->x[body] = drandom(0, SOLAR_SYSTEM_RADIUS);
+        bodies->y[body] = drandom(0, sqrt(pow(SOLAR_SYSTEM_RADIUS, 2) - pow(bodies->x[body], 2)));
+        bodies->z[body] = drandom(0, sqrt(pow(SOLAR_SYSTEM_RADIUS, 2) - pow(bodies->x[body], 2) -
+                                          pow(bodies->y[body], 2)));
 
         /*
          * The comet is required to be heading towards the centre, thus
@@ -142,23 +215,35 @@ bool random_comet(struct body_struct *body) {
         // Assign a random value to total velocity
         double velocity = drandom(1000, 40000);
         // Solve equation 1
-        double a = body->y / body->x;
+        double a = bodies->y[body] / bodies->x[body];
         // Solve equation 2
-        double b = body->z / body->x;
+        double b = bodies->z[body] / bodies->x[body];
         // Solve equation 3
-        body->velocity_x = sqrt(pow(velocity, 2) / (1 + pow(a, 2) + pow(b, 2)));
-        body->velocity_y = a * body->velocity_x;
-        body->velocity_z = b * body->velocity_x;
-
-        body->mass = drandom(1e10, 9e14);
-        body->radius = drandom(2, 6);
-        body->type = COMET;
-        body->active = true;
+        bodies->velocity_x[body] = sqrt(pow(velocity, 2) / (1 + pow(a, 2) + pow(b, 2)));
+        bodies->velocity_y[body] = a * bodies->velocity_x[body];
+        bodies->velocity_z[body] = b * bodies->velocity_x[body];
+
+        bodies->mass[body] = drandom(1e10, 9e14);
+        bodies->radius[body] = drandom(2, 6);
+        bodies->type[body] = COMET;
+        bodies->active[body] = true;
         return true;
     }
     return false;
 }
 
+/*
+ * Counter-based random number, the same key and counter always give the same number whatever was drawn before, so
+ * every process draws the same numbers for the same collisions without sharing the state of a generator
+ * The key and counter are mixed by the finaliser of SplitMix64
+ */
+uint64_t counter_random(uint64_t key, uint64_t counter) {
+    uint64_t z = key * 0x9E3779B97F4A7C15ULL + counter;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
 /*
  * This function handles the situation when two asteroids collide and split into 4 parts
  * Unit vector is used to determine the moving direction of a newly generated asteroid
@@ -180,24 +265,24 @@ bool random_comet(struct body_struct *body) {
  * they have different velocities. Even if the collided two asteroids have exactly the same velocities, the newly
  * generated four asteroids will have different velocities after one timestamp due to the mutual force among them
  */
-void split_asteroid(struct body_struct *ori_body, struct body_struct *new_body, bool direction) {
+void split_asteroid(struct body_store *bodies, int ori_body, int new_body, bool direction) {
     int unit_vector = 2;
     if (!direction)
         unit_vector = -1;
 
-    new_body->active = true;
-    new_body->type = ASTEROID;
-    ori_body->active = false;
-    new_body->mass = ori_body->mass / 2;
-    new_body->radius = ori_body->radius / 2;
+    bodies->active[new_body] = true;
+    bodies->type[new_body] = ASTEROID;
+    bodies->active[ori_body] = false;
+    bodies->mass[new_body] = bodies->mass[ori_body] / 2;
+    bodies->radius[new_body] = bodies->radius[ori_body] / 2;
 
-    new_body->velocity_x = unit_vector * ori_body->velocity_x;
-    new_body->velocity_y = unit_vector * ori_body->velocity_y;
-    new_body->velocity_z = unit_vector * ori_body->velocity_z;
+    bodies->velocity_x[new_body] = unit_vector * bodies->velocity_x[ori_body];
+    bodies->velocity_y[new_body] = unit_vector * bodies->velocity_y[ori_body];
+    bodies->velocity_z[new_body] = unit_vector * bodies->velocity_z[ori_body];
 
-    new_body->x = unit_vector * ori_body->radius * 2 + ori_body->x;
-    new_body->y = unit_vector * ori_body->radius * 2 + ori_body->y;
-    new_body->z = unit_vector * ori_body->radius * 2 + ori_body->y;
+    bodies->x[new_body] = unit_vector * bodies->radius[ori_body] * 2 + bodies->x[ori_body];
+    bodies->y[new_body] = unit_vector * bodies->radius[ori_body] * 2 + bodies->y[ori_body];
+    bodies->z[new_body] = unit_vector * bodies->radius[ori_body] * 2 + bodies->y[ori_body];
 }
 
 /*
@@ -205,24 +290,24 @@ void split_asteroid(struct body_struct *ori_body, struct body_struct *new_body,
 * but sufficient for our purposes, that conserves kinetic energy of the two bodies. The equation is
 * an angle free elastic collision described towards the end of https://en.wikipedia.org/wiki/Elastic_collision
 */
-static void update_body_momentum_elastic_collision(struct body_struct *body1, struct body_struct *body2) {
-    double m1 = body1->mass;
-    double m2 = body2->mass;
+static void update_body_momentum_elastic_collision(struct body_store *bodies, int body1, int body2) {
+    double m1 = bodies->mass[body1];
+    double m2 = bodies->mass[body2];
     double M = m1 + m2;
 
-    double x1 = body1->x;
-    double y1 = body1->y;
-    double z1 = body1->z;
-    double x2 = body2->x;
-    double y2 = body2->y;
-    double z2 = body2->z;
+    double x1 = bodies->x[body1];
+    double y1 = bodies->y[body1];
+    double z1 = bodies->z[body1];
+    double x2 = bodies->x[body2];
+    double y2 = bodies->y[body2];
+    double z2 = bodies->z[body2];
 
-    double velo_x1 = body1->velocity_x;
-    double velo_y1 = body1->velocity_y;
-    double velo_z1 = body1->velocity_z;
-    double velo_x2 = body2->velocity_x;
-    double velo_y2 = body2->velocity_y;
-    double velo_z2 = body2->velocity_z;
+    double velo_x1 = bodies->velocity_x[body1];
+    double velo_y1 = bodies->velocity_y[body1];
+    double velo_z1 = bodies->velocity_z[body1];
+    double velo_x2 = bodies->velocity_x[body2];
+    double velo_y2 = bodies->velocity_y[body2];
+    double velo_z2 = bodies->velocity_z[body2];
 
     double x_diff = x1 - x2;
     double y_diff = y1 - y2;
@@ -235,9 +320,9 @@ static void update_body_momentum_elastic_collision(struct body_struct *body1, st
 
     double dot_product = (velocity_x_diff * x_diff) + (velocity_y_diff * y_diff) + (velocity_z_diff * z_diff);
 
-    body1->acceleration_x = velo_x1 - ((2 * m2) / M) * (dot_product / d) * x_diff;
-    body1->acceleration_y = velo_y1 - ((2 * m2) / M) * (dot_product / d) * y_diff;
-    body1->acceleration_z = velo_z1 - ((2 * m2) / M) * (dot_product / d) * z_diff;
+    bodies->acceleration_x[body1] = velo_x1 - ((2 * m2) / M) * (dot_product / d) * x_diff;
+    bodies->acceleration_y[body1] = velo_y1 - ((2 * m2) / M) * (dot_product / d) * y_diff;
+    bodies->acceleration_z[body1] = velo_z1 - ((2 * m2) / M) * (dot_product / d) * z_diff;
 }
 
 /*
@@ -258,10 +343,11 @@ static double drandom(double low, double high) {
 /*
  * Print information of a body for debugging
  */
-void tostring(struct body_struct *body){
-    printf("Name: %s\tMass: %f\tRadius: %f\tStatus: %d\n", body->name, body->mass, body->radius, body->active);
-    printf("Position: (%f, %f, %f)\tVelocity: (%f, %f, %f)\n", body->x, body->y, body->z,
-           body->velocity_x, body->velocity_y, body->velocity_z);
-    printf("Type: %d\tAsteroid collisions: %d\tComets collisions: %d\n",body->type,
-           body->collided_asteroids, body->collided_comets);
+void tostring(struct body_store *bodies, int body){
+    printf("Name: %s\tMass: %f\tRadius: %f\tStatus: %d\n", bodies->metadata[body].name, bodies->mass[body],
+           bodies->radius[body], bodies->active[body]);
+    printf("Position: (%f, %f, %f)\tVelocity: (%f, %f, %f)\n", bodies->x[body], bodies->y[body], bodies->z[body],
+           bodies->velocity_x[body], bodies->velocity_y[body], bodies->velocity_z[body]);
+    printf("Type: %d\tAsteroid collisions: %d\tComets collisions: %d\n",bodies->type[body],
+           bodies->metadata[body].collided_asteroids, bodies->metadata[body].collided_comets);
 }
\ No newline at end of file
@@ -2,22 +2,23 @@
 #define SUPPORT_INCLUDE
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Gravitational constant
+#define G_CONSTANT 6.67408e-11
 
 // Type of a body
 enum body_type_enum {
     SUN = 0, PLANET = 1, MOON = 2, ASTEROID = 3, COMET = 4, UNKNOWN = 20
 };
 
-// Information about each body that is updated as the simulation progresses
-struct body_struct {
+/*
+ * Cold information about each body, it is only read when reporting results
+ * Keeping it apart from the hot state means the force and collision loops never pull names into cache
+ */
+struct body_metadata {
     char name[40];
-    double x, y, z;
-    double mass;
-    double velocity_x, velocity_y, velocity_z;
-    double acceleration_x, acceleration_y, acceleration_z;
-    double radius;
-    bool active;
-    enum body_type_enum type;
     /*
      * These two variables will be initialised only if the body is of type sun, planet or moon
      */
@@ -25,30 +26,66 @@ struct body_struct {
     int collided_comets; // number of collisions with comets
 };
 
+/*
+ * Information about each body that is updated as the simulation progresses, stored as structure of arrays
+ * Body i is made up of x[i], y[i], ..., type[i] and metadata[i]
+ * All the double fields live in one block of NUM_BODY_STATE_FIELDS * capacity elements, one field after another, so
+ * the state of a body can be described to MPI as a strided column of that block (see initialise_function)
+ */
+struct body_store {
+    int capacity;
+    double *state; // the block that all double fields point into
+    // Fields that change every timestep come first, so they can be exchanged without the rest of the state
+    double *x, *y, *z;
+    double *velocity_x, *velocity_y, *velocity_z;
+    double *acceleration_x, *acceleration_y, *acceleration_z;
+    double *mass;
+    double *radius;
+    bool *active;
+    enum body_type_enum *type;
+    struct body_metadata *metadata;
+};
+
+// Number of double fields in body_store.state
+#define NUM_BODY_STATE_FIELDS 11
+
+// Number of leading double fields (position and velocity) that are updated by every timestep
+#define NUM_BODY_DYNAMIC_FIELDS 6
+
 /*
  * This structure is created to store history data because it's need only in process 0
- * As a result, the three pointer variables are removed from the original structure (i.e. body_struct)
+ * As a result, the three pointer variables are kept out of the body state (i.e. body_store)
  */
 struct body_history{
     double *history_x, *history_y, *history_z;
 };
 
-bool checkForCollision(struct body_struct *, struct body_struct *);
+void allocate_body_store(struct body_store *, int);
+
+size_t body_store_size(int);
+
+void place_body_store(struct body_store *, int, void *);
+
+bool checkForCollision(struct body_store *, int, int);
+
+double checkForSweptCollision(struct body_store *, double *, double *, double *, int, int);
+
+double earliest_contact_time(struct body_store *, int, int, double);
 
-void calculate_two_body_acceleration(struct body_struct *, struct body_struct *);
+void handle_planet_asteroid_collision(struct body_store *, int, int);
 
-void handle_planet_asteroid_collision(struct body_struct *, struct body_struct *);
+bool handle_asteroid_asteroid_collision(struct body_store *, int, int, bool);
 
-bool handle_asteroid_asteroid_collision(struct body_struct *, struct body_struct *);
+void split_asteroid(struct body_store *, int, int, bool direction);
 
-void split_asteroid(struct body_struct *, struct body_struct *, bool direction);
+void handle_comet_comet_collision(struct body_store *, int, int);
 
-void handle_comet_comet_collision(struct body_struct *, struct body_struct *);
+void handle_asteroid_comet_collision(struct body_store *, int, int);
 
-void handle_asteroid_comet_collision(struct body_struct *, struct body_struct *);
+bool random_comet(struct body_store *, int);
 
-bool random_comet(struct body_struct *);
+uint64_t counter_random(uint64_t, uint64_t);
 
-void tostring(struct body_struct *);
+void tostring(struct body_store *, int);
 
 #endif
\ No newline at end of file
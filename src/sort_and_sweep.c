@@ -0,0 +1,110 @@
+#include "sort_and_sweep.h"
+#include <stdlib.h>
+#include <math.h>
+
+static void interval(struct body_store *, int, double *, double, struct sweep_interval *);
+
+static int compare_intervals(const void *, const void *);
+
+/*
+ * Allocate the order for up to capacity bodies, it starts empty
+ */
+void allocate_sort_and_sweep(struct sort_and_sweep *sweep, int capacity) {
+    sweep->count = 0;
+    sweep->bodies = 0;
+    sweep->swaps = 0;
+    sweep->order = (int *) malloc(sizeof(int) * capacity);
+    sweep->listed = (bool *) calloc(capacity, sizeof(bool));
+    sweep->incoming = (struct sweep_interval *) malloc(sizeof(struct sweep_interval) * capacity);
+    sweep->low = (double *) malloc(sizeof(double) * capacity);
+    sweep->high = (double *) malloc(sizeof(double) * capacity);
+}
+
+/*
+ * Bring the order up to date with the first count bodies: drop the bodies that were removed, take the intervals again
+ * and sort them by insertion, which is O(N) when the order barely changed, then merge in the bodies that appeared
+ * The interval of a body is its extent along x widened by margin on both sides, and when start_x is given it also
+ * covers the extent at the start of the timestep
+ * When members are given, only the active members are kept in the order, and the members that were not in it yet are
+ * merged in wherever they are
+ */
+void update_sort_and_sweep(struct sort_and_sweep *sweep, struct body_store *bodies, int count, double *start_x,
+                           double margin, bool *members) {
+    int kept = 0;
+    for (int k = 0; k < sweep->count; k++) {
+        int i = sweep->order[k];
+        if (bodies->active[i] && (members == NULL || members[i]))
+            sweep->order[kept++] = i;
+        else
+            sweep->listed[i] = false;
+    }
+    int incoming = 0;
+    for (int i = members == NULL ? sweep->bodies : 0; i < count; i++) {
+        if (bodies->active[i] && (members == NULL || members[i]) && !sweep->listed[i]) {
+            sweep->listed[i] = true;
+            sweep->incoming[incoming].body = i;
+            interval(bodies, i, start_x, margin, &sweep->incoming[incoming++]);
+        }
+    }
+    sweep->bodies = count;
+
+    for (int k = 0; k < kept; k++) {
+        struct sweep_interval body_interval;
+        interval(bodies, sweep->order[k], start_x, margin, &body_interval);
+        sweep->low[k] = body_interval.low;
+        sweep->high[k] = body_interval.high;
+    }
+    for (int k = 1; k < kept; k++) {
+        int body = sweep->order[k];
+        double low = sweep->low[k], high = sweep->high[k];
+        int m = k;
+        while (m > 0 && sweep->low[m - 1] > low) {
+            sweep->order[m] = sweep->order[m - 1];
+            sweep->low[m] = sweep->low[m - 1];
+            sweep->high[m] = sweep->high[m - 1];
+            m--;
+        }
+        sweep->swaps += k - m;
+        sweep->order[m] = body;
+        sweep->low[m] = low;
+        sweep->high[m] = high;
+    }
+
+    // The bodies that appeared are sorted on their own and merged from the end, into the free positions after the order
+    qsort(sweep->incoming, incoming, sizeof(struct sweep_interval), &compare_intervals);
+    int k = kept - 1, n = incoming - 1;
+    for (int m = kept + incoming - 1; n >= 0; m--) {
+        if (k >= 0 && sweep->low[k] > sweep->incoming[n].low) {
+            sweep->order[m] = sweep->order[k];
+            sweep->low[m] = sweep->low[k];
+            sweep->high[m] = sweep->high[k--];
+        } else {
+            sweep->order[m] = sweep->incoming[n].body;
+            sweep->low[m] = sweep->incoming[n].low;
+            sweep->high[m] = sweep->incoming[n--].high;
+        }
+    }
+    sweep->count = kept + incoming;
+}
+
+/*
+ * Interval along x that a body covers
+ */
+static void interval(struct body_store *bodies, int i, double *start_x, double margin,
+                     struct sweep_interval *body_interval) {
+    double low = bodies->x[i], high = bodies->x[i];
+    if (start_x != NULL) {
+        low = fmin(low, start_x[i]);
+        high = fmax(high, start_x[i]);
+    }
+    body_interval->low = low - bodies->radius[i] - margin;
+    body_interval->high = high + bodies->radius[i] + margin;
+}
+
+/*
+ * Order of two intervals by their lower end, for qsort
+ */
+static int compare_intervals(const void *a, const void *b) {
+    double low_a = ((const struct sweep_interval *) a)->low, low_b = ((const struct sweep_interval *) b)->low;
+    return (low_a > low_b) - (low_a < low_b);
+}
@@ -0,0 +1,35 @@
+#ifndef SORT_AND_SWEEP_INCLUDE
+#define SORT_AND_SWEEP_INCLUDE
+
+#include <stdbool.h>
+#include "simulation_support.h"
+
+/*
+ * Interval along x covered by a body
+ */
+struct sweep_interval {
+    double low, high;
+    int body;
+};
+
+/*
+ * Active bodies sorted by the lower end of the interval they cover along x, two bodies can only touch if their
+ * intervals overlap
+ * The order is kept from one timestep to the next, bodies barely move within a timestep so it is sorted again with
+ * very few swaps
+ */
+struct sort_and_sweep {
+    int count; // active bodies in the order
+    int bodies; // bodies already looked at, the later ones are merged into the order when they appear
+    bool *listed; // per body, whether it is in the order
+    struct sweep_interval *incoming; // bodies that are not in the order yet, sorted before they are merged into it
+    int *order; // body of every position
+    double *low, *high; // interval of the body at every position
+    long int swaps; // positions exchanged to sort the order again, over all timesteps
+};
+
+void allocate_sort_and_sweep(struct sort_and_sweep *, int);
+
+void update_sort_and_sweep(struct sort_and_sweep *, struct body_store *, int, double *, double, bool *);
+
+#endif
@@ -0,0 +1,56 @@
+#include "spatial_hash.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/*
+ * Allocate a hash for up to capacity bodies
+ */
+void allocate_spatial_hash(struct spatial_hash *hash, int capacity) {
+    int buckets = 1;
+    while (buckets < 2 * capacity) buckets *= 2;
+    hash->capacity = capacity;
+    hash->mask = buckets - 1;
+    hash->bucket_start = (int *) malloc(sizeof(int) * (buckets + 1));
+    hash->bodies = (int *) malloc(sizeof(int) * capacity);
+    hash->cell_x = (long int *) malloc(sizeof(long int) * capacity);
+    hash->cell_y = (long int *) malloc(sizeof(long int) * capacity);
+    hash->cell_z = (long int *) malloc(sizeof(long int) * capacity);
+}
+
+/*
+ * Put the active bodies among the first count bodies into cells of the given size, only the members when given
+ * The bodies are sorted by bucket with a counting sort, so building the hash is O(N)
+ */
+void build_spatial_hash(struct spatial_hash *hash, struct body_store *bodies, int count, double cell_size,
+                        bool *members) {
+    int buckets = hash->mask + 1;
+    hash->cell_size = cell_size;
+    memset(hash->bucket_start, 0, sizeof(int) * (buckets + 1));
+    for (int i = 0; i < count; i++) {
+        if (!bodies->active[i] || (members != NULL && !members[i])) continue;
+        hash->cell_x[i] = (long int) floor(bodies->x[i] / cell_size);
+        hash->cell_y[i] = (long int) floor(bodies->y[i] / cell_size);
+        hash->cell_z[i] = (long int) floor(bodies->z[i] / cell_size);
+        hash->bucket_start[spatial_hash_bucket(hash, hash->cell_x[i], hash->cell_y[i], hash->cell_z[i]) + 1]++;
+    }
+    for (int b = 0; b < buckets; b++) hash->bucket_start[b + 1] += hash->bucket_start[b];
+    int total = hash->bucket_start[buckets];
+    // Fill every bucket from its end, which leaves bucket_start[b + 1] at the first body of bucket b
+    for (int i = count - 1; i >= 0; i--) {
+        if (!bodies->active[i] || (members != NULL && !members[i])) continue;
+        int bucket = spatial_hash_bucket(hash, hash->cell_x[i], hash->cell_y[i], hash->cell_z[i]);
+        hash->bodies[--hash->bucket_start[bucket + 1]] = i;
+    }
+    for (int b = 0; b < buckets; b++) hash->bucket_start[b] = hash->bucket_start[b + 1];
+    hash->bucket_start[buckets] = total;
+}
+
+/*
+ * Bucket of a cell, different cells may share a bucket so the cell of every body found in it has to be compared
+ */
+int spatial_hash_bucket(struct spatial_hash *hash, long int x, long int y, long int z) {
+    unsigned long int key = (unsigned long int) x * 73856093UL ^ (unsigned long int) y * 19349663UL ^
+                            (unsigned long int) z * 83492791UL;
+    return (int) ((key ^ key >> 29) & hash->mask);
+}
@@ -0,0 +1,27 @@
+#ifndef SPATIAL_HASH_INCLUDE
+#define SPATIAL_HASH_INCLUDE
+
+#include <stdbool.h>
+#include "simulation_support.h"
+
+/*
+ * Uniform grid of cubic cells over the active bodies, stored as a hash table so that only occupied cells take memory
+ * Two bodies can only touch if they sit in the same or in neighbouring cells when the cells are at least as wide as
+ * the largest sum of two radii
+ */
+struct spatial_hash {
+    double cell_size;
+    int capacity;
+    int mask; // buckets - 1, the number of buckets is a power of two at least twice the number of bodies
+    int *bucket_start; // bodies of bucket b are bodies[bucket_start[b], bucket_start[b + 1])
+    int *bodies; // active bodies sorted by bucket
+    long int *cell_x, *cell_y, *cell_z; // per body, the cell that holds it
+};
+
+void allocate_spatial_hash(struct spatial_hash *, int);
+
+void build_spatial_hash(struct spatial_hash *, struct body_store *, int, double, bool *);
+
+int spatial_hash_bucket(struct spatial_hash *, long int, long int, long int);
+
+#endif